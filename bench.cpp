@@ -0,0 +1,271 @@
+#include "compiled_rewrite_system.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <sys/resource.h>
+
+// Benchmarks for the completion and for reducing with its result. Every measurement is printed as one json object per
+// line on stdout, so runs can be compared with a script. The optional argument only runs the benchmarks whose name
+// contains it.
+//
+//   completion: seconds, cycles, whether it completed within maxcycles, the size of the result, the amount of
+//               reductions done along the way, the peak of KnuthBendixCompletion::approximateMemoryUsage() over the
+//               cycles and the peak resident set size of the process so far.
+//   reduction:  normal forms of long random words, with the automaton of the completion and with its compiled dfa.
+
+struct symbolinfo {
+    typedef char symboltype;
+    typedef std::string stringtype;
+};
+
+typedef std::vector<std::pair<std::string, std::string>> presentation;
+
+struct Mode {
+    const char *name;
+    bool incremental;
+    unsigned threads;
+    bool overlap_index;
+};
+
+const Mode modes[] = {{"sweep",       false, 1, false},
+                      {"incremental", true,  1, false},
+                      {"parallel",    false, 4, false},
+                      {"indexed",     false, 1, true}};
+
+std::string filter;
+
+std::size_t peakRss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (std::size_t) usage.ru_maxrss * 1024;
+}
+
+double secondsSince(const std::chrono::steady_clock::time_point &start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The presentations.
+
+presentation triangleGroup() { // test1
+    return {{"1x", "x"}, {"1y", "y"}, {"x1", "x"}, {"y1", "y"}, {"xxx", "1"}, {"yyy", "1"}, {"xyxyxy", "1"}};
+}
+
+presentation numericSystem() { // test3
+    return {{"12", "3"}, {"12", "21"}, {"5", "32"}, {"4", "22"}, {"2", "11"}, {"54", "9"}, {"8", "53"}};
+}
+
+char generator(const int i) {
+    return (char) ('a' + i);
+}
+
+// a_i a_i+1 = a_i+2, indexes modulo n.
+presentation fibonacci(const int n) {
+    presentation ret;
+    for (int i = 0; i < n; ++i) {
+        ret.emplace_back(std::string{generator(i), generator((i + 1) % n)}, std::string{generator((i + 2) % n)});
+    }
+    return ret;
+}
+
+// Coxeter generators of the symmetric group on n points, the identity is the empty string.
+presentation symmetricGroup(const int n) {
+    presentation ret;
+    for (int i = 0; i + 1 < n; ++i) {
+        ret.emplace_back(std::string{generator(i), generator(i)}, "");
+        for (int j = i + 2; j + 1 < n; ++j) {
+            ret.emplace_back(std::string{generator(j), generator(i)}, std::string{generator(i), generator(j)});
+        }
+        if (i + 2 < n) {
+            ret.emplace_back(std::string{generator(i + 1), generator(i), generator(i + 1)}, std::string{generator(i), generator(i + 1), generator(i)});
+        }
+    }
+    return ret;
+}
+
+// The positive braid monoid on n strands: the symmetric group without the involutions. Its completion is infinite.
+presentation braidMonoid(const int n) {
+    presentation ret;
+    for (const auto &r : symmetricGroup(n)) {
+        if (!r.second.empty()) {
+            ret.push_back(r);
+        }
+    }
+    return ret;
+}
+
+presentation randomMonoid(const int generators, const int relations, const int maxlength, const unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> symbol(0, generators - 1);
+    std::uniform_int_distribution<int> length(1, maxlength);
+    const auto word = [&]() {
+        std::string ret;
+        for (int l = length(rng); l > 0; --l) {
+            ret.push_back(generator(symbol(rng)));
+        }
+        return ret;
+    };
+    presentation ret;
+    for (int i = 0; i < relations; ++i) {
+        ret.emplace_back(word(), word());
+    }
+    return ret;
+}
+
+std::vector<std::string> randomWords(const std::string &alphabet, const std::size_t count, const std::size_t length, const unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<std::size_t> symbol(0, alphabet.size() - 1);
+    std::vector<std::string> ret(count);
+    for (auto &w : ret) {
+        for (std::size_t i = 0; i < length; ++i) {
+            w.push_back(alphabet[symbol(rng)]);
+        }
+    }
+    return ret;
+}
+
+// The benchmarks.
+
+typedef KnuthBendixCompletion<symbolinfo, std::size_t, CompletionStats> shortlexcompletion;
+
+template<typename completiontype>
+void complete(const std::string &name, const Mode &mode, completiontype &kbc, const presentation &p, const int maxcycles) {
+    kbc.incremental_deduction = mode.incremental;
+    kbc.deduce_threads = mode.threads;
+    kbc.overlap_index = mode.overlap_index;
+    for (const auto &r : p) {
+        kbc.addIdentity(r.first, r.second);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const bool completed = kbc.run(maxcycles);
+    const double seconds = secondsSince(start);
+
+    const auto total = kbc.stats.total();
+    std::size_t peak_memory = 0;
+    for (const auto &c : kbc.stats.cycles) {
+        peak_memory = std::max(peak_memory, c.memory_bytes);
+    }
+    std::cout << "{\"benchmark\": \"" << name << "\", \"kind\": \"completion\", \"mode\": \"" << mode.name << "\""
+              << ", \"seconds\": " << seconds
+              << ", \"cycles\": " << kbc.cycle_count
+              << ", \"completed\": " << (completed ? "true" : "false")
+              << ", \"rules\": " << kbc.current_rules.size()
+              << ", \"identities\": " << kbc.current_identities.size()
+              << ", \"postponed\": " << kbc.postponed_identities.size()
+              << ", \"strings\": " << kbc.ss->strings.size()
+              << ", \"automaton_states\": " << kbc.actree.liveStates()
+              << ", \"critical_pairs\": " << total.critical_pairs
+              << ", \"reductions\": " << total.reductions
+              << ", \"reductions_per_second\": " << (seconds > 0 ? total.reductions / seconds : 0)
+              << ", \"peak_memory_estimate_bytes\": " << peak_memory
+              << ", \"peak_rss_bytes\": " << peakRss()
+              << "}" << std::endl;
+}
+
+// limits sets the critical pair limits of the completion, if any.
+void benchCompletion(const std::string &name, const presentation &p, const int maxcycles,
+                     const std::function<void(shortlexcompletion &)> &limits = nullptr) {
+    if (name.find(filter) == std::string::npos) {
+        return;
+    }
+    for (const auto &mode : modes) {
+        StringStorage<symbolinfo, std::size_t> ss;
+        ss.hashed_index = true;
+        shortlexcompletion kbc(&ss);
+        if (limits) {
+            limits(kbc);
+        }
+        complete(name, mode, kbc, p, maxcycles);
+    }
+}
+
+void benchNumericSystem() {
+    const std::string name = "numeric";
+    if (name.find(filter) == std::string::npos) {
+        return;
+    }
+    typedef SymbolPreferenceOrdering<char> orderingtype;
+    for (const std::string desired : {"1", "29"}) {
+        for (const auto &mode : modes) {
+            StringStorage<symbolinfo, std::size_t> ss;
+            KnuthBendixCompletion<symbolinfo, std::size_t, CompletionStats, orderingtype> kbc(&ss, orderingtype(desired));
+            complete(name + "-" + desired, mode, kbc, numericSystem(), 5);
+        }
+    }
+}
+
+// Reduces count random words of the given length, first with the automaton of the completion and then with the dfa.
+void benchReduction(const std::string &name, const presentation &p, const std::string &alphabet, const std::size_t count, const std::size_t length) {
+    if (name.find(filter) == std::string::npos) {
+        return;
+    }
+    StringStorage<symbolinfo, std::size_t> ss;
+    shortlexcompletion kbc(&ss);
+    for (const auto &r : p) {
+        kbc.addIdentity(r.first, r.second);
+    }
+    kbc.run();
+    const auto words = randomWords(alphabet, count, length, 1);
+    const CompiledRewriteSystem<symbolinfo> compiled(kbc);
+
+    const auto report = [&](const char *engine, const double seconds, const std::size_t checksum) {
+        std::cout << "{\"benchmark\": \"" << name << "\", \"kind\": \"reduction\", \"engine\": \"" << engine << "\""
+                  << ", \"words\": " << count
+                  << ", \"word_length\": " << length
+                  << ", \"seconds\": " << seconds
+                  << ", \"words_per_second\": " << (seconds > 0 ? count / seconds : 0)
+                  << ", \"symbols_per_second\": " << (seconds > 0 ? count * length / seconds : 0)
+                  << ", \"normal_form_symbols\": " << checksum
+                  << ", \"peak_rss_bytes\": " << peakRss()
+                  << "}" << std::endl;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::size_t checksum = 0;
+    for (const auto &w : words) {
+        checksum += kbc.reduceView(w.begin(), w.end()).first.size();
+    }
+    report("automaton", secondsSince(start), checksum);
+
+    start = std::chrono::steady_clock::now();
+    checksum = 0;
+    for (const auto &w : words) {
+        compiled.reduce(w.begin(), w.end(), [&](const bool, const char *begin, const char *end) {
+            checksum += end - begin;
+        });
+    }
+    report("compiled", secondsSince(start), checksum);
+
+    start = std::chrono::steady_clock::now();
+    checksum = 0;
+    for (const auto &nf : kbc.normalForms(words, 4)) {
+        checksum += nf.size();
+    }
+    report("automaton-4-threads", secondsSince(start), checksum);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        filter = argv[1];
+    }
+    benchCompletion("triangle", triangleGroup(), 1000);
+    benchNumericSystem();
+    for (const int n : {4, 5}) {
+        benchCompletion("fibonacci-" + std::to_string(n), fibonacci(n), 20);
+    }
+    for (const int n : {4, 5, 6}) {
+        benchCompletion("symmetric-" + std::to_string(n), symmetricGroup(n), 1000);
+    }
+    // these don't complete, the amount of rules grows about tenfold per cycle after a while.
+    benchCompletion("braid-3", braidMonoid(3), 12);
+    benchCompletion("braid-4", braidMonoid(4), 5);
+    benchCompletion("braid-4-bounded", braidMonoid(4), 15, [](shortlexcompletion &kbc) {
+        kbc.max_identity_length = 10;
+        kbc.max_active_identities = 200;
+    });
+    for (const int size : {2, 3, 4}) {
+        benchCompletion("random-" + std::to_string(size), randomMonoid(size, size, size + 2, size), 4);
+    }
+    benchReduction("reduce-triangle", triangleGroup(), "xy1", 1000, 10000);
+    benchReduction("reduce-symmetric-6", symmetricGroup(6), "abcde", 100, 10000);
+}
@@ -0,0 +1,184 @@
+#ifndef COMPILED_REWRITE_SYSTEM_HPP
+#define COMPILED_REWRITE_SYSTEM_HPP
+
+#include "knuth_bendix.hpp"
+#include <cstdint>
+#include <map>
+
+// Read-only snapshot of the rules of a KnuthBendixCompletion, meant for answering queries once the completion is done.
+// The automaton is flattened into a dfa: states are dense, every state has a transition for every symbol of the
+// alphabet (the failure links are resolved up front) and an accepting state refers to the rule to apply, stored as
+// the length of the left hand side and the position of the right hand side in one pool of symbols.
+// Reducing is the same single pass leftmost rewriting as KnuthBendixCompletion::reduce, but without any set- or
+// trie lookups along the way.
+template<typename symbolinfo>
+struct CompiledRewriteSystem {
+    typedef typename symbolinfo::symboltype symboltype;
+    typedef typename symbolinfo::stringtype stringtype;
+    typedef uint32_t stateid;
+    static const uint32_t none = ~uint32_t(0);
+
+    struct Match {
+        uint32_t lhs_length;
+        uint32_t rhs_offset; // in pool
+        uint32_t rhs_length;
+    };
+
+    // The tables are views so they can be served straight from a mapped snapshot file (see rewrite_system_snapshot.hpp).
+    SymbolSpan<symboltype> alphabet; // sorted, a symbol is encoded as its position. Any other symbol gets code alphabet.size().
+    SymbolSpan<uint32_t> direct_codes; // for symbols of at most 2 bytes the code gets looked up directly.
+    SymbolSpan<stateid> transitions; // (alphabet.size() + 1) entries per state.
+    SymbolSpan<uint32_t> accepting; // per state an index in matches, or none.
+    SymbolSpan<Match> matches;
+    SymbolSpan<symboltype> pool; // all right hand sides, back to back.
+    std::shared_ptr<const void> backing; // whatever owns the memory behind the views.
+
+    CompiledRewriteSystem() = default;
+
+    template<typename completiontype>
+    explicit CompiledRewriteSystem(completiontype &kbc) {
+        typedef typename completiontype::rule rule;
+        typedef typename completiontype::rules rules;
+        auto &automaton = kbc.actree;
+        automaton.compact(); // every state becomes a row of the table.
+        automaton.updateLinks();
+
+        struct Tables {
+            std::vector <symboltype> alphabet;
+            std::vector <uint32_t> direct_codes;
+            std::vector <stateid> transitions;
+            std::vector <uint32_t> accepting;
+            std::vector <Match> matches;
+            std::vector <symboltype> pool;
+        };
+        const auto tables = std::make_shared<Tables>();
+        auto &alphabet = tables->alphabet;
+        auto &direct_codes = tables->direct_codes;
+        auto &transitions = tables->transitions;
+        auto &accepting = tables->accepting;
+        auto &matches = tables->matches;
+        auto &pool = tables->pool;
+
+        for (const auto &r : kbc.current_rules) {
+            const auto &lhs = kbc.ss->strings[r.first];
+            alphabet.insert(alphabet.end(), lhs.begin(), lhs.end());
+        }
+        std::sort(alphabet.begin(), alphabet.end());
+        alphabet.erase(std::unique(alphabet.begin(), alphabet.end()), alphabet.end());
+        if (std::is_integral<symboltype>::value && sizeof(symboltype) <= 2) {
+            direct_codes.assign(std::size_t(1) << (8 * sizeof(symboltype)), alphabet.size());
+            for (std::size_t c = 0; c < alphabet.size(); ++c) {
+                direct_codes[directIndex(alphabet[c])] = c;
+            }
+        }
+
+        const std::size_t width = alphabet.size() + 1;
+        const std::size_t statecount = automaton.nodes.size();
+        transitions.resize(statecount * width);
+        accepting.assign(statecount, none);
+        std::map <rule, uint32_t> matchindexes;
+        for (std::size_t s = 0; s < statecount; ++s) {
+            for (std::size_t c = 0; c < alphabet.size(); ++c) {
+                transitions[s * width + c] = automaton.step(s, alphabet[c]);
+            }
+            transitions[s * width + alphabet.size()] = 0; // a symbol that isnt part of any rule, back to the root.
+
+            automaton.iterate_outputs(s, [&](const rules &rs, const std::size_t) {
+                if (rs.empty()) {
+                    return true;
+                }
+                const auto inserted = matchindexes.insert(std::make_pair(*rs.begin(), (uint32_t) matches.size()));
+                if (inserted.second) {
+                    const auto &lhs = kbc.ss->strings[rs.begin()->first];
+                    const auto &rhs = kbc.ss->strings[rs.begin()->second];
+                    matches.push_back(Match{(uint32_t) lhs.size(), (uint32_t) pool.size(), (uint32_t) rhs.size()});
+                    pool.insert(pool.end(), rhs.begin(), rhs.end());
+                }
+                accepting[s] = inserted.first->second;
+                return false;
+            });
+        }
+
+        this->alphabet = view(alphabet);
+        this->direct_codes = view(direct_codes);
+        this->transitions = view(transitions);
+        this->accepting = view(accepting);
+        this->matches = view(matches);
+        this->pool = view(pool);
+        backing = tables;
+    }
+
+    template<typename T>
+    static SymbolSpan<T> view(const std::vector <T> &v) {
+        return SymbolSpan<T>(v.data(), v.data() + v.size());
+    }
+
+    static std::size_t directIndex(const symboltype &s) {
+        return (std::size_t) s & ((std::size_t(1) << (8 * sizeof(symboltype))) - 1);
+    }
+
+    uint32_t code(const symboltype &s) const {
+        if (!direct_codes.empty()) {
+            return direct_codes[directIndex(s)];
+        }
+        const auto it = std::lower_bound(alphabet.begin(), alphabet.end(), s);
+        if (it == alphabet.end() || s < *it) {
+            return alphabet.size();
+        }
+        return it - alphabet.begin();
+    }
+
+    // Same contract as KnuthBendixCompletion::reduce: the pointers are only valid during the callback.
+    template<typename iteratortype, typename callbacktype>
+    void reduce(const iteratortype &begin, const iteratortype &end, const callbacktype &fct) const {
+        ScratchBuffer<symboltype> ret_lease;
+        ScratchBuffer<symboltype> todo_lease;
+        ScratchBuffer<stateid> states_lease;
+        auto &ret = *ret_lease;
+        auto &todo = *todo_lease;
+        auto &states = *states_lease;
+        todo.assign(begin, end);
+        std::reverse(todo.begin(), todo.end());
+        states.push_back(0);
+        const std::size_t width = alphabet.size() + 1;
+        bool changed = false;
+        while (!todo.empty()) {
+            ret.push_back(todo.back());
+            todo.pop_back();
+            const stateid s = transitions[states.back() * width + code(ret.back())];
+            states.push_back(s);
+            if (accepting[s] != none) {
+                const Match &m = matches[accepting[s]];
+                ret.resize(ret.size() - m.lhs_length);
+                states.resize(states.size() - m.lhs_length);
+                const symboltype *rhs = pool.begin() + m.rhs_offset;
+                todo.insert(todo.end(), std::reverse_iterator<const symboltype *>(rhs + m.rhs_length), std::reverse_iterator<const symboltype *>(rhs));
+                changed = true;
+            }
+        }
+        fct(changed, ret.data(), ret.data() + ret.size());
+    }
+
+    template<typename iteratortype>
+    std::pair<stringtype, bool> reduceCopy(const iteratortype &begin, const iteratortype &end) const {
+        std::pair<stringtype, bool> ret;
+        reduce(begin,
+               end,
+               [&](const bool changed,
+                   const symboltype *begin,
+                   const symboltype *end) {
+                   ret.first.assign(begin, end);
+                   ret.second = changed;
+               });
+        return ret;
+    }
+
+    std::pair<stringtype, bool> reduceCopy(const stringtype &s) const {
+        return reduceCopy(s.begin(), s.end());
+    }
+};
+
+template<typename symbolinfo>
+const uint32_t CompiledRewriteSystem<symbolinfo>::none;
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef COMPLETION_STATS_HPP
+#define COMPLETION_STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Statistics policies for KnuthBendixCompletion, its third template parameter.
+// NoCompletionStats is the default: all of its hooks are empty and its timers don't read any clock, so the compiler
+// removes them altogether. CompletionStats records per cycle where the time went and what changed.
+
+enum CompletionPhase {
+    phase_introduce,
+    phase_delete,
+    phase_compose,
+    phase_simplify,
+    phase_orient,
+    phase_collapse,
+    phase_deduce,
+    phase_loopdetection,
+    phase_count
+};
+
+inline const char *phaseName(const CompletionPhase p) {
+    static const char *names[phase_count] = {"introduce", "delete", "compose", "simplify", "orient", "collapse", "deduce", "loopdetection"};
+    return names[p];
+}
+
+struct NoCompletionStats {
+    static constexpr bool enabled = false;
+
+    struct Timer {
+        Timer(NoCompletionStats &, const CompletionPhase) {
+        }
+    };
+
+    void ruleAdded() {}
+
+    void ruleRemoved() {}
+
+    void identityAdded() {}
+
+    void identityRemoved() {}
+
+    void criticalPair(const bool /*kept*/) {}
+
+    void identityPostponed() {}
+
+    // may be called from multiple threads at once.
+    void reduced(const std::size_t /*steps*/, const std::size_t /*scanned*/) {}
+
+    template<typename completiontype>
+    void cycleDone(const completiontype &) {}
+};
+
+struct CompletionStats {
+    static constexpr bool enabled = true;
+
+    struct Cycle {
+        std::size_t cycle = 0;
+        double phase_seconds[phase_count] = {};
+        std::size_t rules_added = 0;
+        std::size_t rules_removed = 0;
+        std::size_t identities_added = 0;
+        std::size_t identities_removed = 0;
+        std::size_t critical_pairs = 0; // found by overlapping rules
+        std::size_t critical_pairs_discarded = 0; // trivial after reduction, or known already.
+        std::size_t identities_postponed = 0; // see KnuthBendixCompletion::max_identity_length and max_active_identities.
+        std::size_t reductions = 0; // strings reduced
+        std::size_t reduction_steps = 0; // rules applied, ie matches of the automaton that got used.
+        std::size_t scanned_symbols = 0; // automaton transitions taken while reducing.
+        // the size of things at the end of the cycle.
+        std::size_t rules = 0;
+        std::size_t identities = 0;
+        std::size_t postponed = 0;
+        std::size_t strings = 0;
+        std::size_t automaton_states = 0;
+        std::size_t memory_bytes = 0; // an estimate, see KnuthBendixCompletion::approximateMemoryUsage()
+    };
+
+    Cycle current;
+    std::vector <Cycle> cycles; // the history, one entry per finished cycle.
+    std::function<void(const Cycle &)> on_cycle; // optional, called after every cycle.
+
+    // reductions run on multiple threads during deduction and batch queries.
+    std::atomic <std::size_t> reductions{0};
+    std::atomic <std::size_t> reduction_steps{0};
+    std::atomic <std::size_t> scanned_symbols{0};
+
+    struct Timer {
+        CompletionStats &stats;
+        const CompletionPhase phase;
+        const std::chrono::steady_clock::time_point start;
+
+        Timer(CompletionStats &stats_, const CompletionPhase phase_) :
+                stats(stats_), phase(phase_), start(std::chrono::steady_clock::now()) {
+        }
+
+        ~Timer() {
+            stats.current.phase_seconds[phase] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    };
+
+    void ruleAdded() { ++current.rules_added; }
+
+    void ruleRemoved() { ++current.rules_removed; }
+
+    void identityAdded() { ++current.identities_added; }
+
+    void identityRemoved() { ++current.identities_removed; }
+
+    void criticalPair(const bool kept) {
+        ++current.critical_pairs;
+        if (!kept) {
+            ++current.critical_pairs_discarded;
+        }
+    }
+
+    void identityPostponed() { ++current.identities_postponed; }
+
+    void reduced(const std::size_t steps, const std::size_t scanned) {
+        reductions.fetch_add(1, std::memory_order_relaxed);
+        reduction_steps.fetch_add(steps, std::memory_order_relaxed);
+        scanned_symbols.fetch_add(scanned, std::memory_order_relaxed);
+    }
+
+    template<typename completiontype>
+    void cycleDone(const completiontype &kbc) {
+        current.cycle = kbc.cycle_count;
+        current.reductions = reductions.exchange(0);
+        current.reduction_steps = reduction_steps.exchange(0);
+        current.scanned_symbols = scanned_symbols.exchange(0);
+        current.rules = kbc.current_rules.size();
+        current.identities = kbc.current_identities.size();
+        current.postponed = kbc.postponed_identities.size();
+        current.strings = kbc.ss->strings.size();
+        current.automaton_states = kbc.actree.liveStates();
+        current.memory_bytes = kbc.approximateMemoryUsage();
+        cycles.push_back(current);
+        if (on_cycle) {
+            on_cycle(current);
+        }
+        current = Cycle();
+    }
+
+    // all cycles summed up, the sizes are the ones after the last cycle.
+    Cycle total() const {
+        Cycle ret;
+        for (const auto &c : cycles) {
+            for (int p = 0; p < phase_count; ++p) {
+                ret.phase_seconds[p] += c.phase_seconds[p];
+            }
+            ret.rules_added += c.rules_added;
+            ret.rules_removed += c.rules_removed;
+            ret.identities_added += c.identities_added;
+            ret.identities_removed += c.identities_removed;
+            ret.critical_pairs += c.critical_pairs;
+            ret.critical_pairs_discarded += c.critical_pairs_discarded;
+            ret.identities_postponed += c.identities_postponed;
+            ret.reductions += c.reductions;
+            ret.reduction_steps += c.reduction_steps;
+            ret.scanned_symbols += c.scanned_symbols;
+        }
+        if (!cycles.empty()) {
+            const auto &last = cycles.back();
+            ret.cycle = last.cycle;
+            ret.rules = last.rules;
+            ret.identities = last.identities;
+            ret.postponed = last.postponed;
+            ret.strings = last.strings;
+            ret.automaton_states = last.automaton_states;
+            ret.memory_bytes = last.memory_bytes;
+        }
+        return ret;
+    }
+};
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef DOMINANCE_CATALOG_HPP
+#define DOMINANCE_CATALOG_HPP
+
+#include "rewrite_automaton.hpp"
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// Answers "which entries of a catalog dominate word w, or are dominated by it" for a completed rewrite system, where a
+// dominates b when the normal form of b is a substring of (or equal to) the one of a. The catalog keeps the normal forms
+// of its entries, and a query reduces w once and then takes time proportional to the length of its normal form plus
+// the amount of entries reported:
+// - the entries dominated by w are found by scanning its normal form with an Aho-Corasick automaton over the normal
+//   forms of the entries. A state whose matches got reported during the scan isn't followed again.
+// - the entries that dominate w are found in a generalized suffix automaton over the normal forms of the entries. Every
+//   entry marks the states of its prefixes, and the entries that contain w are those with a mark in the subtree of the
+//   state of w in the tree of suffix links. In the preorder of that tree a subtree is a range of marks, and listing the
+//   distinct entries in a range uses a range minimum over the position of the previous mark of the same entry.
+// Entries with the same normal form share all of the work. Adding entries after a query is fine, the next query of
+// dominating entries rebuilds the tree. Queries are not thread safe: they stamp the automaton as they go.
+template<typename symbolinfo>
+class DominanceCatalog {
+public:
+    typedef typename symbolinfo::symboltype symboltype;
+    typedef typename symbolinfo::stringtype stringtype;
+
+private:
+    static const uint32_t none = ~uint32_t(0);
+
+    struct Form {
+        std::vector <std::size_t> entries;
+        uint64_t seen = 0; // query that reported this state of the Aho-Corasick automaton.
+    };
+
+    struct State {
+        std::vector <std::pair<symboltype, uint32_t>> next; // sorted on symbol
+        uint32_t link = none;
+        std::size_t length = 0;
+        std::vector <uint32_t> marks; // the forms that have a prefix ending here.
+    };
+
+    std::vector <stringtype> normal_forms; // per entry.
+    std::map <stringtype, uint32_t> form_ids;
+    std::vector <const Form *> forms;
+    RewriteAutomaton<symboltype, Form> contained; // over the normal forms.
+    uint64_t query_count = 0;
+
+    std::vector <State> states; // of the suffix automaton.
+    bool tree_dirty = true;
+    std::vector <std::pair<uint32_t, uint32_t>> ranges; // per state, its subtree in marked.
+    std::vector <uint32_t> marked; // the marks in preorder.
+    std::vector <uint32_t> previous; // per mark: 1 + position of the previous mark of the same form, 0 for none.
+    std::vector <std::vector<uint32_t>> minimum; // sparse table: minimum[k][i] = argmin previous over [i, i + 2^k).
+
+    uint32_t transition(const uint32_t s, const symboltype &c) const {
+        const auto &next = states[s].next;
+        const auto it = std::lower_bound(next.begin(), next.end(), c, [](const std::pair<symboltype, uint32_t> &a, const symboltype &b) {
+            return a.first < b;
+        });
+        return it == next.end() || c < it->first ? none : it->second;
+    }
+
+    void setTransition(const uint32_t s, const symboltype &c, const uint32_t t) {
+        auto &next = states[s].next;
+        const auto it = std::lower_bound(next.begin(), next.end(), c, [](const std::pair<symboltype, uint32_t> &a, const symboltype &b) {
+            return a.first < b;
+        });
+        if (it != next.end() && !(c < it->first)) {
+            it->second = t;
+        } else {
+            next.insert(it, std::make_pair(c, t));
+        }
+    }
+
+    // q is reached from p by c but holds longer strings too: they get split off into a clone.
+    uint32_t split(uint32_t p, const symboltype &c, const uint32_t q) {
+        const uint32_t clone = states.size();
+        states.push_back(State());
+        states[clone].next = states[q].next;
+        states[clone].link = states[q].link;
+        states[clone].length = states[p].length + 1;
+        states[q].link = clone;
+        for (; p != none && transition(p, c) == q; p = states[p].link) {
+            setTransition(p, c, clone);
+        }
+        return clone;
+    }
+
+    // The state of the string of last followed by c.
+    uint32_t extend(const uint32_t last, const symboltype &c) {
+        const uint32_t existing = transition(last, c);
+        if (existing != none) {
+            return states[existing].length == states[last].length + 1 ? existing : split(last, c, existing);
+        }
+        const uint32_t cur = states.size();
+        states.push_back(State());
+        states[cur].length = states[last].length + 1;
+        uint32_t p = last;
+        for (; p != none && transition(p, c) == none; p = states[p].link) {
+            setTransition(p, c, cur);
+        }
+        if (p == none) {
+            states[cur].link = 0;
+        } else {
+            const uint32_t q = transition(p, c);
+            states[cur].link = states[q].length == states[p].length + 1 ? q : split(p, c, q);
+        }
+        return cur;
+    }
+
+    uint32_t lowerPrevious(const uint32_t a, const uint32_t b) const {
+        return previous[b] < previous[a] ? b : a;
+    }
+
+    void buildTree() {
+        std::vector <std::vector<uint32_t>> children(states.size());
+        for (uint32_t s = 1; s < states.size(); ++s) {
+            children[states[s].link].push_back(s);
+        }
+        ranges.assign(states.size(), std::make_pair(0u, 0u));
+        marked.clear();
+        std::vector <std::pair<uint32_t, bool>> todo(1, std::make_pair(0u, false)); // true: the subtree is done.
+        while (!todo.empty()) {
+            const auto t = todo.back();
+            todo.pop_back();
+            if (t.second) {
+                ranges[t.first].second = marked.size();
+                continue;
+            }
+            ranges[t.first].first = marked.size();
+            marked.insert(marked.end(), states[t.first].marks.begin(), states[t.first].marks.end());
+            todo.emplace_back(t.first, true);
+            for (const auto c : children[t.first]) {
+                todo.emplace_back(c, false);
+            }
+        }
+        previous.assign(marked.size(), 0);
+        std::vector <uint32_t> last(forms.size(), 0);
+        for (uint32_t i = 0; i < marked.size(); ++i) {
+            previous[i] = last[marked[i]];
+            last[marked[i]] = i + 1;
+        }
+        minimum.assign(1, std::vector<uint32_t>(marked.size()));
+        for (uint32_t i = 0; i < marked.size(); ++i) {
+            minimum[0][i] = i;
+        }
+        for (std::size_t k = 1; (std::size_t(1) << k) <= marked.size(); ++k) {
+            const std::size_t half = std::size_t(1) << (k - 1);
+            minimum.emplace_back(marked.size() - 2 * half + 1);
+            for (std::size_t i = 0; i < minimum[k].size(); ++i) {
+                minimum[k][i] = lowerPrevious(minimum[k - 1][i], minimum[k - 1][i + half]);
+            }
+        }
+        tree_dirty = false;
+    }
+
+    // position of the lowest previous in [begin, end), which isn't empty.
+    uint32_t lowestPrevious(const uint32_t begin, const uint32_t end) const {
+        const unsigned k = 63 - __builtin_clzll(end - begin);
+        return lowerPrevious(minimum[k][begin], minimum[k][end - (uint32_t(1) << k)]);
+    }
+
+    template<typename callbacktype>
+    void reportForm(const Form &form, const callbacktype &fct) const {
+        for (const auto e : form.entries) {
+            fct(e);
+        }
+    }
+
+public:
+    DominanceCatalog() :
+            states(1) {
+    }
+
+    std::size_t size() const {
+        return normal_forms.size();
+    }
+
+    const stringtype &normalForm(const std::size_t entry) const {
+        return normal_forms[entry];
+    }
+
+    // Adds an entry by its normal form and returns its index.
+    std::size_t addNormalForm(const stringtype &normal_form) {
+        const std::size_t entry = normal_forms.size();
+        normal_forms.push_back(normal_form);
+        const auto inserted = form_ids.insert(std::make_pair(normal_form, (uint32_t) forms.size()));
+        Form &form = contained.getOrCreate(normal_form);
+        form.entries.push_back(entry);
+        if (inserted.second) {
+            forms.push_back(&form);
+            const uint32_t id = inserted.first->second;
+            uint32_t last = 0;
+            states[last].marks.push_back(id); // everything contains the empty string.
+            for (const auto &c : normal_form) {
+                last = extend(last, c);
+                states[last].marks.push_back(id);
+            }
+            tree_dirty = true;
+        }
+        return entry;
+    }
+
+    // system: anything with a reduce() like KnuthBendixCompletion or CompiledRewriteSystem.
+    template<typename systemtype, typename wordtype>
+    std::size_t add(systemtype &system, const wordtype &word) {
+        return addNormalForm(reduced(system, word));
+    }
+
+    template<typename systemtype, typename wordtype>
+    static stringtype reduced(systemtype &system, const wordtype &word) {
+        stringtype ret;
+        system.reduce(word.begin(),
+                      word.end(),
+                      [&](const bool,
+                          const symboltype *begin,
+                          const symboltype *end) {
+                          ret.assign(begin, end);
+                      });
+        return ret;
+    }
+
+    // Calls fct(entry) for every entry whose normal form is a substring of normal_form.
+    template<typename callbacktype>
+    void iterateDominatedByNormalForm(const stringtype &normal_form, const callbacktype &fct) {
+        contained.updateLinks();
+        const uint64_t query = ++query_count;
+        const auto report = [&](Form &form, const std::size_t) {
+            if (form.seen == query) {
+                return false; // and so was the rest of the chain.
+            }
+            form.seen = query;
+            reportForm(form, fct);
+            return true;
+        };
+        if (contained.nodes[contained.root].payload) {
+            report(*contained.nodes[contained.root].payload, 0);
+        }
+        auto s = contained.root;
+        for (const auto &c : normal_form) {
+            s = contained.step(s, c);
+            contained.iterate_outputs(s, report);
+        }
+    }
+
+    // Calls fct(entry) for every entry whose normal form contains normal_form.
+    template<typename callbacktype>
+    void iterateDominatingNormalForm(const stringtype &normal_form, const callbacktype &fct) {
+        if (tree_dirty) {
+            buildTree();
+        }
+        uint32_t s = 0;
+        for (const auto &c : normal_form) {
+            s = transition(s, c);
+            if (s == none) {
+                return;
+            }
+        }
+        const uint32_t begin = ranges[s].first;
+        std::vector <std::pair<uint32_t, uint32_t>> todo;
+        if (begin < ranges[s].second) {
+            todo.emplace_back(begin, ranges[s].second);
+        }
+        while (!todo.empty()) {
+            const auto r = todo.back();
+            todo.pop_back();
+            const uint32_t i = lowestPrevious(r.first, r.second);
+            if (previous[i] > begin) {
+                continue; // every form in the range showed up before it already.
+            }
+            reportForm(*forms[marked[i]], fct);
+            if (r.first < i) {
+                todo.emplace_back(r.first, i);
+            }
+            if (i + 1 < r.second) {
+                todo.emplace_back(i + 1, r.second);
+            }
+        }
+    }
+
+    // The entries that word dominates, by the normal form system gives it.
+    template<typename systemtype, typename wordtype, typename callbacktype>
+    void iterateDominatedBy(systemtype &system, const wordtype &word, const callbacktype &fct) {
+        iterateDominatedByNormalForm(reduced(system, word), fct);
+    }
+
+    // The entries that dominate word.
+    template<typename systemtype, typename wordtype, typename callbacktype>
+    void iterateDominating(systemtype &system, const wordtype &word, const callbacktype &fct) {
+        iterateDominatingNormalForm(reduced(system, word), fct);
+    }
+
+    std::size_t stateCount() const {
+        return states.size();
+    }
+};
+
+template<typename symbolinfo>
+const uint32_t DominanceCatalog<symbolinfo>::none;
+
+#endif
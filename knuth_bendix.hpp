@@ -1,12 +1,28 @@
 #ifndef KNUTH_BENDIX_HPP
 #define KNUTH_BENDIX_HPP
 
+#include <algorithm>
 #include <cassert>
-#include <list>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <atomic>
+#include <thread>
+#include <vector>
 #include <deque>
-#include "aho_corasick.hpp" // fast multi-string pattern search
+#include "rewrite_automaton.hpp" // fast multi-string pattern search
 #include "murmur3.h"
+#include "section_file.hpp"
+#include "completion_stats.hpp"
+#include "orderings.hpp"
+#include "packed_symbols.hpp"
+#include "string_pool.hpp"
+#include "normal_form_cache.hpp"
+#include "symbol_invariants.hpp"
 #include <memory>
+#include <type_traits>
 
 // This implementation of lower_bound doesnt require a reference to the value.
 // But it breaks the convention that a comparator accepts 2 params.
@@ -29,6 +45,75 @@ _ForwardIterator lower_bound2(_ForwardIterator __first,
     return __first;
 }
 
+// Leases a reusable buffer from a per-thread arena. Leases nest like a stack, so a reduction started from within the
+// callback of another reduction gets its own buffer. Buffers keep their capacity between leases, which means that
+// once warmed up the reduction code doesn't allocate anymore.
+template<typename symboltype>
+class ScratchBuffer {
+    struct Arena {
+        std::vector <std::unique_ptr<std::vector<symboltype>>> buffers;
+        std::size_t depth = 0;
+    };
+
+    static Arena &arena() {
+        thread_local Arena a;
+        return a;
+    }
+
+    std::vector <symboltype> *buffer;
+
+public:
+    ScratchBuffer() {
+        auto &a = arena();
+        if (a.depth == a.buffers.size()) {
+            a.buffers.emplace_back(new std::vector<symboltype>());
+        }
+        buffer = a.buffers[a.depth++].get();
+        buffer->clear();
+    }
+
+    ~ScratchBuffer() {
+        --arena().depth;
+    }
+
+    ScratchBuffer(const ScratchBuffer &) = delete;
+
+    ScratchBuffer &operator=(const ScratchBuffer &) = delete;
+
+    std::vector <symboltype> &operator*() { return *buffer; }
+
+    std::vector <symboltype> *operator->() { return buffer; }
+};
+
+// Calls fct(i) for every i in [0,count) on the given amount of threads (the calling thread included). The threads
+// claim the indexes in chunks, the order in which they get processed is undefined.
+template<typename callbacktype>
+void parallelFor(const std::size_t count, const unsigned threads, const callbacktype &fct, const std::size_t chunk = 16) {
+    if (threads <= 1 || count < 2) {
+        for (std::size_t i = 0; i < count; ++i) {
+            fct(i);
+        }
+        return;
+    }
+    std::atomic <std::size_t> next(0);
+    const auto worker = [&]() {
+        for (std::size_t first = next.fetch_add(chunk); first < count; first = next.fetch_add(chunk)) {
+            const std::size_t last = std::min(count, first + chunk);
+            for (std::size_t i = first; i < last; ++i) {
+                fct(i);
+            }
+        }
+    };
+    std::vector <std::thread> workers;
+    for (unsigned t = 1; t < threads; ++t) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : workers) {
+        t.join();
+    }
+}
+
 // This allows for using a vector as lookup while storing the payload elsewhere.
 template<class vector_type, typename constructortype, typename eqtest, typename comparatortype>
 typename vector_type::const_iterator insertOrderedUnique(vector_type &v,
@@ -44,33 +129,325 @@ typename vector_type::const_iterator insertOrderedUnique(vector_type &v,
     return it;
 }
 
+template<typename T>
+struct VoidType {
+    typedef void type;
+};
+
+// symbolinfo may define the function objects symbolless and symbolequal, by default the symbols are compared with < and ==.
+template<typename symbolinfo, typename = void>
+struct SymbolLessOf {
+    typedef std::less<typename symbolinfo::symboltype> type;
+};
+
+template<typename symbolinfo>
+struct SymbolLessOf<symbolinfo, typename VoidType<typename symbolinfo::symbolless>::type> {
+    typedef typename symbolinfo::symbolless type;
+};
+
+template<typename symbolinfo, typename = void>
+struct SymbolEqualOf {
+    typedef std::equal_to<typename symbolinfo::symboltype> type;
+};
+
+template<typename symbolinfo>
+struct SymbolEqualOf<symbolinfo, typename VoidType<typename symbolinfo::symbolequal>::type> {
+    typedef typename symbolinfo::symbolequal type;
+};
+
+// symbolinfo may define symbolhash as well, by default std::hash. Only used for symbols that aren't trivially copyable,
+// the others get hashed by their bytes.
+template<typename symbolinfo, typename = void>
+struct SymbolHashOf {
+    typedef std::hash<typename symbolinfo::symboltype> type;
+};
+
+template<typename symbolinfo>
+struct SymbolHashOf<symbolinfo, typename VoidType<typename symbolinfo::symbolhash>::type> {
+    typedef typename symbolinfo::symbolhash type;
+};
+
 template<typename symbolinfo, typename indextype>
 struct StringStorage {
     typedef typename symbolinfo::symboltype symboltype;
     typedef typename symbolinfo::stringtype stringtype;
-    std::deque <stringtype> strings; // all strings get stored here.
+    StringPool <symboltype> strings; // all strings get stored here, strings[i] is a view.
     std::deque <indextype> ordered_stringindexes; // ordered by their associated string. this is the lookup-map for strings.
 
-    std::function<bool(const symboltype &, const symboltype &)> comp = [](const symboltype &a, const symboltype &b) { return a < b; };
-    std::function<bool(const symboltype &, const symboltype &)> eq = [](const symboltype &a, const symboltype &b) { return a == b; };
+    typedef typename SymbolLessOf<symbolinfo>::type symbolless;
+    typedef typename SymbolEqualOf<symbolinfo>::type symbolequal;
+    symbolless comp;
+    symbolequal eq;
+
+    // When set, strings are looked up in a murmur3 hashed open addressing table instead of by binary search over
+    // ordered_stringindexes, which then no longer gets maintained (see orderedStringIndexes()). Switching it off again
+    // rebuilds ordered_stringindexes on the next lookup.
+    // For trivially copyable symbols the hash is computed over their raw bytes, so eq has to agree with bitwise
+    // equality. Other symbols get hashed one by one with symbolhash (see SymbolHashOf), which has to agree with eq.
+    bool hashed_index = false;
+    std::vector <uint64_t> string_hashes; // per string, only for the hashed index.
+    std::vector <indextype> hash_slots; // linear probing, size is a power of 2.
+
+    static constexpr indextype empty_slot = std::numeric_limits<indextype>::max();
+
+    // The concurrent index, see makeConcurrent(). The strings get spread over shards by their hash. Every shard has an
+    // open addressing table that gets probed without locking: slots are only ever filled in, and a table that got
+    // outgrown stays around for whoever is still probing it. Not finding a string takes the lock of the shard, which
+    // looks again and appends it to the strings under append_mutex.
+    struct ConcurrentTable {
+        std::size_t mask;
+        std::unique_ptr<std::atomic<indextype>[]> slots;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::atomic<ConcurrentTable *> table{nullptr};
+        std::vector <std::unique_ptr<ConcurrentTable>> tables; // the current one last.
+        std::vector <std::pair<uint64_t, indextype>> members; // with their hash, for growing the table.
+    };
+
+    static const unsigned shard_bits = 6;
+
+    struct ConcurrentIndex {
+        Shard shards[1u << shard_bits];
+        std::mutex append_mutex;
+    };
+
+    std::unique_ptr <ConcurrentIndex> concurrent_index;
+
+    // Optional, see setInvariants(): invariants->stride values per string, computed when the string gets added.
+    std::shared_ptr<const SymbolInvariants<symboltype>> invariants;
+    SegmentedVector <int64_t> string_summaries;
+
+    void appendSummary(const indextype index) {
+        ScratchBuffer<int64_t> lease;
+        lease->resize(invariants->stride);
+        invariants->summarize(strings[index].begin(), strings[index].end(), lease->data());
+        for (const auto x : *lease) {
+            string_summaries.push_back(x);
+        }
+    }
+
+    // Every string that gets added goes through here, so the summaries stay in step with strings.
+    template<typename iteratortype>
+    indextype appendString(const iteratortype &begin, const iteratortype &end) {
+        const indextype ret = strings.append(begin, end);
+        if (invariants) {
+            appendSummary(ret);
+        }
+        return ret;
+    }
+
+    // Summarizes every string from here on, and the ones there already. Null drops the summaries.
+    // Replaces the summaries in place, so like compact() it needs the storage to itself.
+    void setInvariants(const std::shared_ptr<const SymbolInvariants<symboltype>> &i) {
+        invariants = i;
+        string_summaries = SegmentedVector<int64_t>();
+        if (invariants) {
+            for (std::size_t index = 0; index < strings.size(); ++index) {
+                appendSummary(index);
+            }
+        }
+    }
+
+    // invariants->stride values. The stride is a power of 2 of at most 64 and the segments are multiples of 64 long,
+    // so the summary of a string is contiguous.
+    const int64_t *summary(const indextype index) const {
+        return &string_summaries[index * invariants->stride];
+    }
+
+    static uint64_t hashSymbols(const symboltype *begin, const symboltype *end, std::true_type) {
+        uint64_t h[2];
+        MurmurHash3_x64_128(begin, (end - begin) * sizeof(symboltype), 42, h);
+        return h[0];
+    }
+
+    template<typename iteratortype>
+    static uint64_t hashSymbols(const iteratortype &begin, const iteratortype &end, std::true_type) {
+        ScratchBuffer<symboltype> lease;
+        lease->assign(begin, end);
+        const symboltype *data = lease->data();
+        return hashSymbols(data, data + lease->size(), std::true_type());
+    }
+
+    // the hashes of the symbols, murmured together.
+    template<typename iteratortype>
+    static uint64_t hashSymbols(const iteratortype &begin, const iteratortype &end, std::false_type) {
+        const typename SymbolHashOf<symbolinfo>::type hash;
+        ScratchBuffer<uint64_t> lease;
+        for (auto i = begin; i != end; ++i) {
+            lease->push_back(hash(*i));
+        }
+        uint64_t h[2];
+        MurmurHash3_x64_128(lease->data(), lease->size() * sizeof(uint64_t), 42, h);
+        return h[0];
+    }
+
+    template<typename iteratortype>
+    static uint64_t hashSymbols(const iteratortype &begin, const iteratortype &end) {
+        return hashSymbols(begin, end, std::is_trivially_copyable<symboltype>());
+    }
+
+    void insertHashSlot(const indextype index) {
+        const std::size_t mask = hash_slots.size() - 1;
+        std::size_t slot = string_hashes[index] & mask;
+        while (hash_slots[slot] != empty_slot) {
+            slot = (slot + 1) & mask;
+        }
+        hash_slots[slot] = index;
+    }
+
+    // grows the table and brings it up to date with strings, which also covers switching hashed_index on later on.
+    void reserveHashSlots(const std::size_t count) {
+        const bool behind = string_hashes.size() != strings.size();
+        for (std::size_t i = string_hashes.size(); i < strings.size(); ++i) {
+            string_hashes.push_back(hashSymbols(strings[i].begin(), strings[i].end()));
+        }
+        if (behind || count * 2 > hash_slots.size()) {
+            std::size_t newsize = 16;
+            while (newsize < count * 2) {
+                newsize *= 2;
+            }
+            hash_slots.assign(newsize, empty_slot);
+            for (std::size_t i = 0; i < string_hashes.size(); ++i) {
+                insertHashSlot(i);
+            }
+        }
+    }
+
+    template<typename iteratortype>
+    indextype getOrCreateStringHashed(const iteratortype &begin, const iteratortype &end) {
+        if (string_hashes.size() != strings.size() || (strings.size() + 1) * 2 > hash_slots.size()) {
+            reserveHashSlots(strings.size() + 1);
+        }
+        const uint64_t h = hashSymbols(begin, end);
+        const std::size_t mask = hash_slots.size() - 1;
+        for (std::size_t slot = h & mask; hash_slots[slot] != empty_slot; slot = (slot + 1) & mask) {
+            const indextype index = hash_slots[slot];
+            if (string_hashes[index] == h && symbolsEqual(begin, end, strings[index].begin(), strings[index].end(), eq)) {
+                return index;
+            }
+        }
+        const indextype ret = appendString(begin, end);
+        string_hashes.push_back(h);
+        insertHashSlot(ret);
+        return ret;
+    }
+
+    static void insertConcurrentSlot(ConcurrentTable &table, const uint64_t h, const indextype index) {
+        std::size_t slot = h & table.mask;
+        while (table.slots[slot].load(std::memory_order_relaxed) != empty_slot) {
+            slot = (slot + 1) & table.mask;
+        }
+        table.slots[slot].store(index, std::memory_order_release);
+    }
+
+    static void growConcurrentTable(Shard &shard) {
+        std::unique_ptr <ConcurrentTable> table(new ConcurrentTable());
+        std::size_t size = 16;
+        while (size < 4 * shard.members.size()) {
+            size *= 2;
+        }
+        table->mask = size - 1;
+        table->slots.reset(new std::atomic<indextype>[size]);
+        for (std::size_t i = 0; i < size; ++i) {
+            table->slots[i].store(empty_slot, std::memory_order_relaxed);
+        }
+        for (const auto &m : shard.members) {
+            insertConcurrentSlot(*table, m.first, m.second);
+        }
+        shard.table.store(table.get(), std::memory_order_release);
+        shard.tables.push_back(std::move(table));
+    }
+
+    template<typename iteratortype>
+    indextype findConcurrent(const ConcurrentTable *table, const uint64_t h, const iteratortype &begin, const iteratortype &end) const {
+        if (!table) {
+            return empty_slot;
+        }
+        for (std::size_t slot = h & table->mask;; slot = (slot + 1) & table->mask) {
+            const indextype index = table->slots[slot].load(std::memory_order_acquire);
+            if (index == empty_slot || symbolsEqual(begin, end, strings[index].begin(), strings[index].end(), eq)) {
+                return index;
+            }
+        }
+    }
+
+    template<typename iteratortype>
+    indextype getOrCreateStringConcurrent(const iteratortype &begin, const iteratortype &end) {
+        const uint64_t h = hashSymbols(begin, end);
+        Shard &shard = concurrent_index->shards[h >> (64 - shard_bits)];
+        indextype ret = findConcurrent(shard.table.load(std::memory_order_acquire), h, begin, end);
+        if (ret != empty_slot) {
+            return ret;
+        }
+        std::lock_guard <std::mutex> lock(shard.mutex);
+        ret = findConcurrent(shard.table.load(std::memory_order_relaxed), h, begin, end); // it may have been added meanwhile.
+        if (ret != empty_slot) {
+            return ret;
+        }
+        {
+            std::lock_guard <std::mutex> append_lock(concurrent_index->append_mutex);
+            ret = appendString(begin, end);
+        }
+        shard.members.emplace_back(h, ret);
+        ConcurrentTable *table = shard.table.load(std::memory_order_relaxed);
+        if (!table || shard.members.size() * 2 > table->mask + 1) {
+            growConcurrentTable(shard);
+        } else {
+            insertConcurrentSlot(*table, h, ret);
+        }
+        return ret;
+    }
+
+    // From here on getOrCreateString may be called from any amount of threads at once, and strings[i] may be read
+    // without any locking for every i that was handed out, also while other threads add strings. A string keeps its
+    // index, but which of 2 new strings gets the lower one depends on the timing of the threads.
+    // Call before sharing the storage. orderedStringIndexes(), compact() and setInvariants() still need the storage to
+    // themselves.
+    void makeConcurrent() {
+        concurrent_index.reset(new ConcurrentIndex());
+        for (std::size_t i = 0; i < strings.size(); ++i) {
+            const uint64_t h = hashSymbols(strings[i].begin(), strings[i].end());
+            concurrent_index->shards[h >> (64 - shard_bits)].members.emplace_back(h, i);
+        }
+        for (auto &shard : concurrent_index->shards) {
+            growConcurrentTable(shard);
+        }
+        ordered_stringindexes.clear();
+        string_hashes.clear();
+        hash_slots.clear();
+    }
+
+    bool concurrent() const {
+        return concurrent_index != nullptr;
+    }
 
     template<typename iteratortype>
     indextype getOrCreateString(const iteratortype &begin, const iteratortype &end) {
+        if (concurrent()) {
+            return getOrCreateStringConcurrent(begin, end);
+        }
+        if (hashed_index) {
+            return getOrCreateStringHashed(begin, end);
+        }
+        if (ordered_stringindexes.size() != strings.size()) {
+            const auto ordered = orderedStringIndexes(); // strings got added while hashed_index was set.
+            ordered_stringindexes.assign(ordered.begin(), ordered.end());
+        }
         // check ordered_stringindexes if it exists already, if not store it in strings and put the index in ordered_stringindexes. return the index.
         indextype ret = *insertOrderedUnique(ordered_stringindexes,
                                              [&]() { // constructor
-                                                 indextype ret = strings.size();
-                                                 strings.emplace_back(begin, end);
-                                                 return ret;
+                                                 return (indextype) appendString(begin, end);
                                              },
                                              [&](const indextype &index) -> bool {
                                                  const auto &o = strings[index];
-                                                 return std::equal(begin, end, o.begin(), o.end(), eq); // we might want a binary predicate from symbolinfo...
+                                                 return symbolsEqual(begin, end, o.begin(), o.end(), eq);
                                              },
                                              [&](const indextype &index) -> bool { // comparator
                                                  const auto &o = strings[index];
                                                  //return kbc.complexity_comparison(o.begin(), o.end(), begin,end);
-                                                 return std::lexicographical_compare(o.begin(), o.end(), begin, end, comp);
+                                                 return symbolsLess(o.begin(), o.end(), begin, end, comp);
                                              });
 
         //std::cerr << "string index " << ret << " is " << toString(begin,end) << std::endl;
@@ -81,9 +458,76 @@ struct StringStorage {
     indextype getOrCreateString(const stringtype2 &s) {
         return getOrCreateString(s.begin(), s.end());
     }
+
+    // All string indexes ordered by their string. With the hashed or the concurrent index, or before the ordered index
+    // caught up after switching hashed_index off, this has to be sorted on demand.
+    std::vector <indextype> orderedStringIndexes() const {
+        if (!hashed_index && !concurrent() && ordered_stringindexes.size() == strings.size()) {
+            return std::vector<indextype>(ordered_stringindexes.begin(), ordered_stringindexes.end());
+        }
+        std::vector <indextype> ret(strings.size());
+        for (std::size_t i = 0; i < ret.size(); ++i) {
+            ret[i] = i;
+        }
+        std::sort(ret.begin(), ret.end(), [&](const indextype a, const indextype b) {
+            return symbolsLess(strings[a].begin(), strings[a].end(), strings[b].begin(), strings[b].end(), comp);
+        });
+        return ret;
+    }
+
+    // Drops the strings for which keep is false and returns the new index of every old one, empty_slot for the dropped
+    // ones. The strings that remain keep their relative order, so anything ordered by index stays ordered.
+    std::vector <indextype> compact(const std::vector<bool> &keep) {
+        std::vector <indextype> remap(strings.size(), empty_slot);
+        StringPool <symboltype> kept;
+        std::vector <uint64_t> kept_hashes;
+        for (std::size_t i = 0; i < strings.size(); ++i) {
+            if (keep[i]) {
+                remap[i] = kept.append(strings[i].begin(), strings[i].end());
+                if (i < string_hashes.size()) {
+                    kept_hashes.push_back(string_hashes[i]);
+                }
+            }
+        }
+        strings = std::move(kept);
+        std::deque <indextype> kept_indexes;
+        for (const auto i : ordered_stringindexes) {
+            if (remap[i] != empty_slot) {
+                kept_indexes.push_back(remap[i]);
+            }
+        }
+        ordered_stringindexes.swap(kept_indexes);
+        string_hashes.swap(kept_hashes);
+        hash_slots.clear();
+        setInvariants(invariants);
+        if (concurrent()) {
+            makeConcurrent();
+        } else if (hashed_index) {
+            reserveHashSlots(strings.size());
+        }
+        return remap;
+    }
 };
 
-template<typename symbolinfo, typename stringid>
+template<typename symbolinfo, typename indextype>
+constexpr indextype StringStorage<symbolinfo, indextype>::empty_slot;
+
+template<typename symbolinfo, typename indextype>
+const unsigned StringStorage<symbolinfo, indextype>::shard_bits;
+
+// Drops every string of the storage that none of the given completions refers to anymore and renumbers the others in
+// all of them. All completions that share the storage have to be passed, any other string id held on to becomes invalid.
+// Returns the amount of dropped strings.
+template<typename storagetype, typename... completiontypes>
+std::size_t collectStringGarbage(storagetype &ss, completiontypes &... kbcs) {
+    std::vector<bool> keep(ss.strings.size(), false);
+    (void) std::initializer_list<int>{(kbcs.markStrings(keep), 0)...};
+    const auto remap = ss.compact(keep);
+    (void) std::initializer_list<int>{(kbcs.remapStrings(remap), 0)...};
+    return remap.size() - ss.strings.size();
+}
+
+template<typename symbolinfo, typename stringid, typename statstype = NoCompletionStats, typename orderingtype = ShortLexOrdering>
 struct KnuthBendixCompletion {
     typedef typename symbolinfo::symboltype symboltype;
     typedef typename symbolinfo::stringtype stringtype;
@@ -98,19 +542,35 @@ struct KnuthBendixCompletion {
     identities input_identities; // the inputs are stored to allow reprocessing them.
     identities current_identities; // these will be converted into rules eventually
     rules current_rules; // these are going to be rewritten till they converge ... if they converge at all ...
-    aho_corasick::basic_trie<stringtype, rules> actree; // given a inputstring this will efficiently give all the rules that got triggered (and where...).
+    typedef RewriteAutomaton<symboltype, rules, typename stringstoragetype::symbolless> automatontype;
+    automatontype actree; // given a inputstring this will efficiently give all the rules that got triggered (and where...).
 
-    KnuthBendixCompletion(stringstoragetype *ss_) :
-            ss(ss_) {
+    statstype stats; // see completion_stats.hpp
+
+    // The complexity ordering, see orderings.hpp. It can't be changed afterwards since the keys of the strings depend on it.
+    const orderingtype ordering;
+    std::vector <typename orderingtype::keytype> ordering_keys; // per string id, filled in on first use.
+
+    KnuthBendixCompletion(stringstoragetype *ss_, const orderingtype &ordering_ = orderingtype()) :
+            ss(ss_), actree(ss_->comp), ordering(ordering_) {
     }
 
-    std::function<bool(const stringtype &, const stringtype &)> complexity_comparison = [&](const stringtype &a, const stringtype &b) {
-        if (a.size() < b.size())
-            return true;
-        if (a.size() > b.size())
-            return false;
-        return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), ss->comp);
-    };
+    // The storage can be shared with other completions, so the keys follow the strings lazily.
+    void updateOrderingKeys(const stringid upto) {
+        while (ordering_keys.size() <= (std::size_t) upto) {
+            ordering_keys.push_back(ordering.key(ss->strings[ordering_keys.size()]));
+        }
+    }
+
+    // true when a is less complex than b.
+    bool complexityLess(const stringid a, const stringid b) {
+        updateOrderingKeys(std::max(a, b));
+        const int c = ordering.compareKeys(ordering_keys[a], ordering_keys[b]);
+        if (c) {
+            return c < 0;
+        }
+        return ordering.less(ss->strings[a], ss->strings[b], ss->comp);
+    }
 
     struct Bits128 {
         uint64_t a, b;
@@ -123,10 +583,78 @@ struct KnuthBendixCompletion {
                 return o.a < a;
             }
         }
+
+        bool operator==(const Bits128 &o) const {
+            return a == o.a && b == o.b;
+        }
     };
 
     std::set <Bits128> hashed_states; // anti-loop detection
 
+    // Order independent fingerprint of current_rules and current_identities: the sum of a 128 bit hash per element,
+    // kept up to date by the functions that insert and erase them. state_changes counts those inserts and erases.
+    Bits128 state_fingerprint{0, 0};
+    std::size_t state_changes = 0;
+
+    // When set, loop detection only recognises a fixpoint: a cycle that ended in the state it started from. That takes
+    // no history at all, but a completion that keeps going round through several states only stops at maxcycles.
+    bool fixpoint_detection_only = false;
+
+    static Bits128 elementHash(const std::pair <stringid, stringid> &p, const uint32_t seed) {
+        const uint64_t ids[2] = {(uint64_t) p.first, (uint64_t) p.second};
+        Bits128 ret;
+        MurmurHash3_x64_128(ids, sizeof(ids), seed, &ret);
+        return ret;
+    }
+
+    // seed 42 for rules, 43 for identities: a rule and an identity on the same strings are different state.
+    void fingerprintAdd(const std::pair <stringid, stringid> &p, const uint32_t seed) {
+        const Bits128 h = elementHash(p, seed);
+        state_fingerprint.a += h.a;
+        state_fingerprint.b += h.b;
+        ++state_changes;
+    }
+
+    void fingerprintRemove(const std::pair <stringid, stringid> &p, const uint32_t seed) {
+        const Bits128 h = elementHash(p, seed);
+        state_fingerprint.a -= h.a;
+        state_fingerprint.b -= h.b;
+        ++state_changes;
+    }
+
+    // for when the rules or identities got replaced wholesale.
+    void recomputeFingerprint() {
+        state_fingerprint = Bits128{0, 0};
+        for (const auto &r : current_rules) {
+            fingerprintAdd(r, 42);
+        }
+        for (const auto &e : current_identities) {
+            fingerprintAdd(e, 43);
+        }
+    }
+
+    // When set (before running), tryDeduce no longer overlaps all pairs of rules every cycle. Instead every rule that
+    // enters current_rules gets queued once against the rules present at that moment (itself included) and only those
+    // pairs get overlapped.
+    bool incremental_deduction = false;
+
+    struct PendingPair {
+        std::size_t weight; // combined length of both left hand sides, smallest pairs go first.
+        rule a, b;
+
+        bool operator<(const PendingPair &o) const {
+            if (weight != o.weight) {
+                return weight < o.weight;
+            }
+            if (a != o.a) {
+                return a < o.a;
+            }
+            return b < o.b;
+        }
+    };
+
+    std::set <PendingPair> pending_pairs;
+
     template<typename iteratortype>
     stringid getOrCreateString(const iteratortype &begin, const iteratortype &end) {
         return ss->getOrCreateString(begin, end);
@@ -138,64 +666,221 @@ struct KnuthBendixCompletion {
     }
 
     equality orderIdentity(const equality &eq) {
-        if (complexity_comparison(ss->strings[eq.first], ss->strings[eq.second])) {
+        if (complexityLess(eq.first, eq.second)) {
             return equality(eq.second, eq.first);
         }
         return eq;
     }
 
     void addIdentity(const stringtype &a, const stringtype &b) {
-        const auto identity = orderIdentity(std::make_pair(getOrCreateString(a), getOrCreateString(b)));
-        input_identities.insert(identity);
+        addIdentity(std::make_pair(getOrCreateString(a), getOrCreateString(b)));
+    }
+
+    // for strings that are in the storage already.
+    void addIdentity(const equality &e) {
+        input_identities.insert(orderIdentity(e));
+        inputs_settled = false;
+        if (invariants && !preservesInvariants(e)) {
+            detectInvariants(); // an identity that breaks them would make equivalent() deny what the rules derive.
+        }
+    }
+
+    void addRule(const rule &new_rule) {
+        if (!current_rules.insert(new_rule).second) {
+            return;
+        }
+        ++rules_generation;
+        fingerprintAdd(new_rule, 42);
+        stats.ruleAdded();
+        const auto &lhs = ss->strings[new_rule.first];
+        actree.getOrCreate(lhs.begin(), lhs.end()).insert(new_rule);
+        if (incremental_deduction) {
+            for (const auto &r : current_rules) {
+                pending_pairs.insert(PendingPair{lhs.size() + ss->strings[r.first].size(), new_rule, r});
+            }
+        }
+    }
+
+    // the caller is supposed to have taken the rule out of actree already.
+    typename rules::iterator eraseRule(const typename rules::iterator &i) {
+        ++rules_generation;
+        stats.ruleRemoved();
+        fingerprintRemove(*i, 42);
+        return current_rules.erase(i);
+    }
+
+    bool insertIdentity(const equality &e) {
+        if (!current_identities.insert(e).second) {
+            return false;
+        }
+        fingerprintAdd(e, 43);
+        stats.identityAdded();
+        return true;
+    }
+
+    typename identities::iterator eraseIdentity(const typename identities::iterator &i) {
+        stats.identityRemoved();
+        fingerprintRemove(*i, 43);
+        return current_identities.erase(i);
+    }
+
+    // Limits on what the completion takes on at once, to get a usable partial system out of a presentation that blows
+    // up. 0 means no limit.
+    // - A critical pair with a side longer than max_identity_length doesn't become an identity but gets postponed.
+    // - After deduction only the max_active_identities shortest identities stay, the others get postponed.
+    // - Once there are max_rules rules, tryOrient leaves the remaining identities be.
+    // Postponed identities only come back when the active set saturates: a cycle that would end the completion
+    // releases the shortest max_active_identities of them (all of them without that limit) instead. They are exempt
+    // from max_identity_length from then on.
+    std::size_t max_identity_length = 0;
+    std::size_t max_active_identities = 0;
+    std::size_t max_rules = 0;
+    identities postponed_identities; // not part of the state for loop detection.
+
+    std::size_t identityLength(const equality &e) const {
+        return ss->strings[e.first].size() + ss->strings[e.second].size();
+    }
+
+    bool ruleLimitReached() const {
+        return max_rules && current_rules.size() >= max_rules;
+    }
+
+    void postponeIdentity(const equality &e) {
+        if (postponed_identities.insert(e).second) {
+            stats.identityPostponed();
+        }
+    }
+
+    // the identities ordered by length, shortest first.
+    std::vector <equality> byLength(const identities &from) const {
+        std::vector <std::pair<std::size_t, equality>> sized;
+        for (const auto &e : from) {
+            sized.emplace_back(identityLength(e), e);
+        }
+        std::sort(sized.begin(), sized.end());
+        std::vector <equality> ret;
+        for (const auto &e : sized) {
+            ret.push_back(e.second);
+        }
+        return ret;
+    }
+
+    void limitActiveIdentities() {
+        if (!max_active_identities || current_identities.size() <= max_active_identities) {
+            return;
+        }
+        const auto sorted = byLength(current_identities);
+        for (std::size_t i = max_active_identities; i < sorted.size(); ++i) {
+            eraseIdentity(current_identities.find(sorted[i]));
+            postponeIdentity(sorted[i]);
+        }
+    }
+
+    // returns false when nothing got released.
+    bool releasePostponed() {
+        if (postponed_identities.empty() || ruleLimitReached()) {
+            return false;
+        }
+        const auto sorted = byLength(postponed_identities);
+        const std::size_t count = max_active_identities ? std::min(max_active_identities, sorted.size()) : sorted.size();
+        bool released = false;
+        for (std::size_t i = 0; i < count; ++i) {
+            postponed_identities.erase(sorted[i]);
+            released = insertIdentity(sorted[i]) || released;
+        }
+        return released || releasePostponed();
+    }
+
+    // After run() returned true: the rules are a confluent system for the inputs, no identity got left over.
+    bool confluent() const {
+        return current_identities.empty() && postponed_identities.empty();
+    }
+
+    // A rough estimate of the memory held by the strings, the rules, the identities and the automaton.
+    std::size_t approximateMemoryUsage() const {
+        const std::size_t setnode = 4 * sizeof(void *) + sizeof(rule); // red-black tree node
+        std::size_t ret = ss->strings.memoryUsage() + ss->strings.size() * sizeof(stringid);
+        ret += (input_identities.size() + current_identities.size() + 2 * current_rules.size()) * setnode; // rules are in actree too.
+        ret += hashed_states.size() * (4 * sizeof(void *) + sizeof(Bits128));
+        ret += pending_pairs.size() * (4 * sizeof(void *) + sizeof(PendingPair));
+        ret += postponed_identities.size() * setnode;
+        ret += normal_forms.memoryUsage();
+        for (const auto &n : actree.nodes) {
+            ret += sizeof(n) + n.children.capacity() * sizeof(n.children[0]) + (n.payload ? sizeof(rules) : 0);
+        }
+        return ret;
+    }
+
+    // runs fct as the given phase of the cycle, for the statistics.
+    template<typename callbacktype>
+    void timed(const CompletionPhase phase, const callbacktype &fct) {
+        typename statstype::Timer timer(stats, phase);
+        fct();
     }
 
     void tryDelete() {
         for (auto i = current_identities.begin(); i != current_identities.end();) {
             const auto &s1 = ss->strings[i->first];
             const auto &s2 = ss->strings[i->second];
-            if (std::equal(s1.begin(), s1.end(), s2.begin(), ss->eq)) {
-                i = current_identities.erase(i);
+            if (symbolsEqual(s1.begin(), s1.end(), s2.begin(), s2.end(), ss->eq)) {
+                i = eraseIdentity(i);
             } else {
                 ++i;
             }
         }
     }
 
+    // Leftmost rewriting in a single pass. The reduced prefix is kept on a stack together with the automaton state
+    // after each of its symbols, the symbols still to be scanned sit reversed on a second stack. When a left hand side
+    // matches, it is popped off the reduced prefix and its replacement gets pushed onto the input, so the scan resumes
+    // from the state right before the match instead of from the start of the string.
+    // The callback receives the reduced string as a pair of pointers into a per-thread scratch buffer, these are only
+    // valid during the callback.
     template<typename iteratortype, typename callbacktype>
     void reduce(const iteratortype &begin, const iteratortype &end, const callbacktype &fct) {
-        std::list <symboltype> ret(begin, end);
+        typedef typename automatontype::stateid stateid;
+        ScratchBuffer<symboltype> ret_lease;
+        ScratchBuffer<symboltype> todo_lease;
+        ScratchBuffer<stateid> states_lease;
+        auto &ret = *ret_lease;
+        auto &todo = *todo_lease;
+        auto &states = *states_lease;
+        todo.assign(begin, end);
+        std::reverse(todo.begin(), todo.end());
+        states.push_back(automatontype::root);
+        actree.updateLinks();
         bool changed = false;
-        bool changed_local = false;
-        //std::cerr << "[";
+        std::size_t steps = 0;
+        std::size_t scanned = 0;
         // i must ... introduce loopdetection ...
-        do {
-
-            changed_local = false;
-            actree.iterate_matches(ret.begin(),
-                                   ret.end(),
-                                   [&](const rules &r,
-                                       const typename std::list<symboltype>::iterator &posbegin,
-                                       const typename std::list<symboltype>::iterator &posend) {
+        while (!todo.empty()) {
+            ++scanned;
+            ret.push_back(todo.back());
+            todo.pop_back();
+            states.push_back(actree.step(states.back(), ret.back()));
+            const rule *match = nullptr;
+            std::size_t matchlen = 0;
+            actree.iterate_outputs(states.back(),
+                                   [&](const rules &r, const std::size_t depth) {
                                        if (r.empty()) {
                                            return true;
                                        }
-                                       const auto &replacement = ss->strings[r.begin()->second];
-                                       //std::cerr << " from string " << std::string(ret.begin(), ret.end()) << " , particularly " << std::string(posbegin,posend) << "  can be replaced by " << std::string(replacement.begin(), replacement.end())  << std::endl;
-
-                                       //std::cerr << " match is " << toString(posbegin,posend) <<std::endl;
-                                       //std::cerr << "applying rule " << toString(strings[r.begin()->first]) << " --> " << toString(strings[r.begin()->second]) << " : " << toString(ret);
-                                       const auto begin2 = ret.erase(posbegin, posend);
-                                       ret.insert(begin2, replacement.begin(), replacement.end());
-                                       //std::cerr << " ==> " << toString(ret) << std::endl;
-
-                                       changed_local = true;
-                                       changed = true;
+                                       match = &*r.begin();
+                                       matchlen = depth;
                                        return false;
                                    });
-
-        } while (changed_local);
-        //std::cerr << "]";
-        fct(changed, ret.begin(), ret.end());
+            if (match) {
+                //std::cerr << "applying rule " << toString(strings[match->first]) << " --> " << toString(strings[match->second]) << " : " << toString(ret);
+                const auto &replacement = ss->strings[match->second];
+                ret.resize(ret.size() - matchlen);
+                states.resize(states.size() - matchlen);
+                todo.insert(todo.end(), replacement.rbegin(), replacement.rend());
+                changed = true;
+                ++steps;
+            }
+        }
+        stats.reduced(steps, scanned);
+        fct(changed, ret.data(), ret.data() + ret.size());
     }
 
     template<typename stringtype, typename callbacktype>
@@ -203,50 +888,187 @@ struct KnuthBendixCompletion {
         reduce(s.begin(), s.end(), fct);
     }
 
+    // Like reduceCopy but without copying the result out of the scratch buffer.
+    // The returned view stays valid until the next reduction on the same thread.
+    template<typename iteratortype>
+    std::pair<SymbolSpan<symboltype>, bool> reduceView(const iteratortype &begin, const iteratortype &end) {
+        std::pair<SymbolSpan<symboltype>, bool> ret;
+        reduce(begin,
+               end,
+               [&](const bool changed,
+                   const symboltype *begin,
+                   const symboltype *end) {
+                   ret = std::make_pair(SymbolSpan<symboltype>(begin, end), changed);
+               });
+        return ret;
+    }
+
+    std::pair<SymbolSpan<symboltype>, bool> reduceView(const stringtype &s) {
+        return reduceView(s.begin(), s.end());
+    }
 
     // what about using std::optional as returntype?
     template<typename iteratortype>
-    std::pair<std::list<symboltype>, bool> reduceCopy(const iteratortype &begin, const iteratortype &end) {
-        std::pair<std::list<symboltype>, bool> ret(std::list<symboltype>(begin, end), false);
-        bool changed_local = false;
-        do {
-            changed_local = false;
-            actree.iterate_matches(ret.first.begin(),
-                                   ret.first.end(),
-                                   [&](const rules &r,
-                                       const typename std::list<symboltype>::iterator &posbegin,
-                                       const typename std::list<symboltype>::iterator &posend) {
-                                       if (r.empty()) {
-                                           return true;
-                                       }
-                                       const auto &replacement = ss->strings[r.begin()->second];
-                                       //std::cerr << " match is " << toString(posbegin,posend) <<std::endl;
-                                       //std::cerr << "applying rule " << toString(strings[r.begin()->first]) << " --> " << toString(strings[r.begin()->second]) << " : " << toString(ret);
-                                       const auto begin2 = ret.first.erase(posbegin, posend);
-                                       ret.first.insert(begin2, replacement.begin(), replacement.end());
-                                       //std::cerr << " ==> " << toString(ret) << std::endl;
-
-                                       changed_local = true;
-                                       ret.second = true;
-                                       return false;
-                                   });
-        } while (changed_local);
+    std::pair<stringtype, bool> reduceCopy(const iteratortype &begin, const iteratortype &end) {
+        std::pair<stringtype, bool> ret;
+        reduce(begin,
+               end,
+               [&](const bool changed,
+                   const symboltype *begin,
+                   const symboltype *end) {
+                   ret.first.assign(begin, end);
+                   ret.second = changed;
+               });
         return ret;
     }
 
-    std::pair<std::list<symboltype>, bool> reduceCopy(const stringtype &s) {
+    std::pair<stringtype, bool> reduceCopy(const stringtype &s) {
         return reduceCopy(s.begin(), s.end());
     }
 
 
+    // Batch queries, meant for after run(). The rules are not modified while answering them so the reductions can run
+    // on multiple threads, each one reducing in its own scratch buffers.
+    template<typename wordtype>
+    std::vector <stringtype> normalForms(const std::vector <wordtype> &words, const unsigned threads = 1) {
+        std::vector <stringtype> ret(words.size());
+        actree.updateLinks();
+        parallelFor(words.size(), threads, [&](const std::size_t i) {
+            reduce(words[i].begin(),
+                   words[i].end(),
+                   [&](const bool,
+                       const symboltype *begin,
+                       const symboltype *end) {
+                       ret[i].assign(begin, end);
+                   });
+        });
+        return ret;
+    }
+
+    struct PairVerdict {
+        bool equivalent; // both have the same normal form.
+        bool first_dominates; // the normal form of the second is a substring of (or equal to) the one of the first, ie the first is "more".
+        bool second_dominates;
+    };
+
+    // Optional, see detectInvariants().
+    std::shared_ptr<const SymbolInvariants<symboltype>> invariants;
+    std::size_t settled_by_invariants = 0; // questions of equivalent() and dominates() answered without reducing.
+
+    // Finds the invariants of the identities, rules and inputs so far (see SymbolInvariants) and has the storage
+    // summarize every string with them. The comparisons then rule out equivalence and dominance up front.
+    // A storage shared with completions of other identities only keeps the summaries of the last one that detected
+    // invariants, the others then summarize their strings on the fly. So does a completion on a concurrent storage, which
+    // other threads may be appending to.
+    void detectInvariants() {
+        std::vector <std::pair<SymbolSpan<symboltype>, SymbolSpan<symboltype>>> presentation;
+        for (const auto *pairs : {&input_identities, &current_identities, &current_rules, &postponed_identities}) {
+            for (const auto &p : *pairs) {
+                presentation.emplace_back(ss->strings[p.first], ss->strings[p.second]);
+            }
+        }
+        invariants = std::make_shared<const SymbolInvariants<symboltype>>(SymbolInvariants<symboltype>::detect(presentation));
+        if (!ss->concurrent()) {
+            ss->setInvariants(invariants);
+        }
+    }
+
+    // Calls fct with the summaries of both strings and returns what it returns.
+    template<typename iteratortype1, typename iteratortype2, typename callbacktype>
+    bool withSummaries(const iteratortype1 &abegin, const iteratortype1 &aend, const iteratortype2 &bbegin, const iteratortype2 &bend, const callbacktype &fct) const {
+        ScratchBuffer<int64_t> a;
+        ScratchBuffer<int64_t> b;
+        a->resize(invariants->stride);
+        b->resize(invariants->stride);
+        invariants->summarize(abegin, aend, a->data());
+        invariants->summarize(bbegin, bend, b->data());
+        return fct(a->data(), b->data());
+    }
+
+    template<typename callbacktype>
+    bool withSummaries(const stringid a, const stringid b, const callbacktype &fct) const {
+        if (ss->invariants == invariants) {
+            return fct(ss->summary(a), ss->summary(b));
+        }
+        return withSummaries(ss->strings[a].begin(), ss->strings[a].end(), ss->strings[b].begin(), ss->strings[b].end(), fct);
+    }
+
+    bool preservesInvariants(const equality &e) const {
+        return withSummaries(e.first, e.second, [&](const int64_t *a, const int64_t *b) { return !invariants->distinct(a, b); });
+    }
+
+    // Whether the invariants rule out both equivalence and either dominance, v gets filled in when they do.
+    bool settledByInvariants(const int64_t *a, const int64_t *b, PairVerdict &v) const {
+        if (!invariants->distinct(a, b) || !invariants->cannotContain(a, b) || !invariants->cannotContain(b, a)) {
+            return false;
+        }
+        v = PairVerdict{false, false, false};
+        return true;
+    }
+
+    // Whether a and b have the same normal form. Strings that the invariants tell apart don't get reduced.
+    bool equivalent(const stringid a, const stringid b) {
+        if (invariants && withSummaries(a, b, [&](const int64_t *x, const int64_t *y) { return invariants->distinct(x, y); })) {
+            ++settled_by_invariants;
+            return false;
+        }
+        return normalForm(a) == normalForm(b);
+    }
+
+    // Whether the normal form of b is a substring of the one of a, ie a is "more". Ruled out without reducing when b
+    // weighs more than a by an invariant with nonnegative weights.
+    bool dominates(const stringid a, const stringid b) {
+        if (invariants && withSummaries(a, b, [&](const int64_t *x, const int64_t *y) { return invariants->cannotContain(x, y); })) {
+            ++settled_by_invariants;
+            return false;
+        }
+        const auto an = ss->strings[normalForm(a)];
+        const auto bn = ss->strings[normalForm(b)];
+        return bn.empty() || std::search(an.begin(), an.end(), bn.begin(), bn.end(), ss->eq) != an.end();
+    }
+
+    // comparePairs for strings in the storage. The normal forms go through normalForm() and so take the cache.
+    PairVerdict compare(const stringid a, const stringid b) {
+        return PairVerdict{equivalent(a, b), dominates(a, b), dominates(b, a)};
+    }
+
+    template<typename wordtype>
+    std::vector <PairVerdict> comparePairs(const std::vector <std::pair<wordtype, wordtype>> &pairs, const unsigned threads = 1) {
+        std::vector <PairVerdict> ret(pairs.size());
+        actree.updateLinks();
+        parallelFor(pairs.size(), threads, [&](const std::size_t i) {
+            if (invariants && withSummaries(pairs[i].first.begin(), pairs[i].first.end(), pairs[i].second.begin(), pairs[i].second.end(),
+                                            [&](const int64_t *a, const int64_t *b) { return settledByInvariants(a, b, ret[i]); })) {
+                return;
+            }
+            reduce(pairs[i].first.begin(),
+                   pairs[i].first.end(),
+                   [&](const bool,
+                       const symboltype *abegin,
+                       const symboltype *aend) {
+                       reduce(pairs[i].second.begin(),
+                              pairs[i].second.end(),
+                              [&](const bool,
+                                  const symboltype *bbegin,
+                                  const symboltype *bend) {
+                                  auto &v = ret[i];
+                                  v.equivalent = symbolsEqual(abegin, aend, bbegin, bend, ss->eq);
+                                  v.first_dominates = std::search(abegin, aend, bbegin, bend, ss->eq) != aend || bbegin == bend;
+                                  v.second_dominates = std::search(bbegin, bend, abegin, aend, ss->eq) != bend || abegin == aend;
+                              });
+                   });
+        });
+        return ret;
+    }
+
     template<typename iteratortype>
     stringid reduceCopyRegister(const iteratortype &begin, const iteratortype &end) {
         stringid ret;
         reduce(begin,
                end,
                [&](const bool,//changed,
-                   const typename std::list<symboltype>::iterator &begin,
-                   const typename std::list<symboltype>::iterator &end) {
+                   const symboltype *begin,
+                   const symboltype *end) {
                    ret = getOrCreateString(begin, end);
                });
         return ret;
@@ -257,24 +1079,57 @@ struct KnuthBendixCompletion {
         return reduceCopyRegister(s.begin(), s.end());
     }
 
+    // Bumped by every change of current_rules, see normal_forms.
+    uint64_t rules_generation = 0;
+
+    // Optional memo for normalForm(), set normal_forms.capacity to use it. It pays off for the strings that get
+    // reduced over and over: the right hand sides and identities from cycle to cycle, and hot query words. An entry
+    // only holds for the rules it was computed with, so once the rules stop changing (after run() completed) it
+    // holds for good.
+    NormalFormCache <stringid> normal_forms;
+
+    // The id of the normal form of string s, which is s itself when no rule applies.
+    stringid normalForm(const stringid s) {
+        stringid ret;
+        if (normal_forms.enabled() && normal_forms.find(s, rules_generation, ret)) {
+            return ret;
+        }
+        const auto str = ss->strings[s];
+        reduce(str.begin(),
+               str.end(),
+               [&](const bool changed,
+                   const symboltype *begin,
+                   const symboltype *end) {
+                   ret = changed ? getOrCreateString(begin, end) : s;
+               });
+        if (normal_forms.enabled()) {
+            normal_forms.insert(s, rules_generation, ret);
+        }
+        return ret;
+    }
+
+    // For queries: interns the word, and from then on looking up its normal form takes the cache.
+    template<typename iteratortype>
+    SymbolSpan <symboltype> normalForm(const iteratortype &begin, const iteratortype &end) {
+        return ss->strings[normalForm(getOrCreateString(begin, end))];
+    }
+
     void tryCompose() {
         // this only modifies rules, but the actree needs to be updated in tandem.
         for (auto i = current_rules.begin(); i != current_rules.end();) {
             const auto &s1 = ss->strings[i->first];
-            const auto &s2 = ss->strings[i->second];
-            auto mmm = reduceCopy(s2.begin(), s2.end());
-            if (mmm.second) {
+            const stringid s2normal = normalForm(i->second);
+            if (s2normal != i->second) {
                 //std::cerr << "tryCompose: rewriting " << toString(s2) << " to " << toString(mmm.first) << std::endl;
                 //assert(sum(s2) == sum(mmm.first));
                 //assertss(sum(s2) == sum(mmm.first), pt(sum(s2)) << pt(sum(mmm.first)) );
-                auto *actreenode = actree.getNodeOrCreate(s1);
-                assert(actreenode->payload.get());
-                actreenode->payload->erase(*i);
-                rule new_rule = std::make_pair(i->first, getOrCreateString(mmm.first.begin(), mmm.first.end()));
+                auto *payload = actree.getNoCreate(s1);
+                assert(payload);
+                payload->erase(*i);
+                rule new_rule = std::make_pair(i->first, s2normal);
                 assert(new_rule.second != i->second); // we are supposed to have changed something remember...
-                i = current_rules.erase(i);
-                current_rules.insert(new_rule);
-                actreenode->payload->insert(new_rule);
+                i = eraseRule(i);
+                addRule(new_rule);
             } else {
                 ++i;
             }
@@ -284,26 +1139,25 @@ struct KnuthBendixCompletion {
     void trySimplify() {
         for (auto i = current_identities.begin(); i != current_identities.end();) {
             const auto &s1 = ss->strings[i->first];
-            const auto &s2 = ss->strings[i->second];
             //auto s1reduced = reduceCopy(s1.begin(),s1.end());
             auto s1reduced = std::make_pair(s1, false);
-            auto s2reduced = reduceCopy(s2.begin(), s2.end());
-            if (s1reduced.second || s2reduced.second) {
+            const stringid s2normal = normalForm(i->second);
+            if (s1reduced.second || s2normal != i->second) {
                 auto new_identity = *i;
                 if (s1reduced.second) {
                     //std::cerr << "trySimplify: rewriting " << toString(s1) << " to " << toString(s1reduced.first) << std::endl;
                     //assertss(sum(s1) == sum(s1reduced.first), pt(sum(s1)) << pt(sum(s1reduced.first)) );
                     new_identity.first = getOrCreateString(s1reduced.first);
                 }
-                if (s2reduced.second) {
+                if (s2normal != i->second) {
                     //std::cerr << "trySimplify: rewriting " << toString(s2) << " to " << toString(s2reduced.first) << std::endl;
                     //assertss(sum(s2) == sum(s2reduced.first), pt(sum(s2)) << pt(sum(s2reduced.first)) );
-                    new_identity.second = getOrCreateString(s2reduced.first);
+                    new_identity.second = s2normal;
                 }
                 assert(new_identity != *i); // we are supposed to have changed something remember...
-                i = current_identities.erase(i);
+                i = eraseIdentity(i);
                 if (new_identity.first != new_identity.second) {
-                    current_identities.insert(orderIdentity(new_identity));
+                    insertIdentity(orderIdentity(new_identity));
                 }
             } else {
                 ++i;
@@ -312,21 +1166,15 @@ struct KnuthBendixCompletion {
     }
 
     void tryOrient() {
-        for (auto i = current_identities.begin(); i != current_identities.end();) {
-            const auto &s1 = ss->strings[i->first];
-            const auto &s2 = ss->strings[i->second];
-            if (complexity_comparison(s1, s2)) {
+        for (auto i = current_identities.begin(); i != current_identities.end() && !ruleLimitReached();) {
+            if (complexityLess(i->first, i->second)) {
                 //std::cerr << "tryOrient(1): adding rule " << toString(s2) << " --> " << toString(s1) <<  pt(s2.size()) << " " << pt(s1.size())  << std::endl;
-                auto new_rule = std::make_pair(i->second, i->first);
-                current_rules.insert(new_rule);
-                actree.getOrCreate(s2.begin(), s2.end()).insert(new_rule);
-                i = current_identities.erase(i);
-            } else if (complexity_comparison(s2, s1)) {
+                addRule(std::make_pair(i->second, i->first));
+                i = eraseIdentity(i);
+            } else if (complexityLess(i->second, i->first)) {
                 //std::cerr << "tryOrient(2): adding rule " << toString(s1) << " --> " << toString(s2) << std::endl;
-                auto new_rule = std::make_pair(i->first, i->second);
-                current_rules.insert(new_rule);
-                actree.getOrCreate(s1.begin(), s1.end()).insert(new_rule);
-                i = current_identities.erase(i);
+                addRule(std::make_pair(i->first, i->second));
+                i = eraseIdentity(i);
             } else {
                 ++i;
             }
@@ -408,9 +1256,9 @@ struct KnuthBendixCompletion {
 
             reduce(ss->strings[i->first],
                    [&](const bool changed,
-                       const typename std::list<symboltype>::iterator &begin,
-                       const typename std::list<symboltype>::iterator &end) {
-                       if (changed && std::equal(begin, end, ss->strings[i->second].begin(), ss->strings[i->second].end(), ss->eq)) {
+                       const symboltype *begin,
+                       const symboltype *end) {
+                       if (changed && symbolsEqual(begin, end, ss->strings[i->second].begin(), ss->strings[i->second].end(), ss->eq)) {
                            //std::cerr << "collapsing rule: " << toString(strings[i->first]) << " --> " << toString(strings[i->second]) << std::endl;
                            //std::cerr << "collapsed rule became identity: " << toString(reducedstuff.first) << " == " << toString(strings[i->second]) << std::endl;
                            equality new_identity(getOrCreateString(begin, end), i->second);
@@ -418,10 +1266,10 @@ struct KnuthBendixCompletion {
                                new_identity = orderIdentity(new_identity);
                                if (current_identities.find(new_identity) == current_identities.end()) {
                                    //std::cerr << "collapsed rule became identity: " << toString(strings[new_identity.first]) << " == " << toString(strings[new_identity.second]) << std::endl;
-                                   current_identities.insert(new_identity);
+                                   insertIdentity(new_identity);
                                }
                            }
-                           i = current_rules.erase(i);
+                           i = eraseRule(i);
                        } else {
                            // not obsolete yet,
                            ptr->insert(*i);
@@ -433,127 +1281,571 @@ struct KnuthBendixCompletion {
         }
     }
 
+    // The critical pair of the left hand side of v put at position offset of the one of u, where they have to agree. v
+    // either lies within u, or starts in u and goes on past its end. Calls fct(a, b), a and b are not reduced yet.
+    // a is a stringtype, b is either a stringtype or a view on a right hand side.
+    template<typename callbacktype>
+    void overlapAt(const rule &u, const rule &v, const int offset, const callbacktype &fct) const {
+        const auto s1 = ss->strings[u.first];
+        const auto s2 = ss->strings[v.first];
+        stringtype cp1(s1.begin(), s1.begin() + offset);
+        cp1.insert(cp1.end(), ss->strings[v.second].begin(), ss->strings[v.second].end());
+        if (offset + s2.size() <= s1.size()) {
+            cp1.insert(cp1.end(), s1.begin() + offset + s2.size(), s1.end());
+            fct(cp1, ss->strings[u.second]);
+        } else {
+            stringtype cp2(ss->strings[u.second].begin(), ss->strings[u.second].end());
+            cp2.insert(cp2.end(), s2.begin() + (s1.size() - offset), s2.end());
+            fct(cp1, cp2);
+        }
+    }
+
+    // Overlaps the left hand sides of 2 rules and calls fct(a, b) for every critical pair, see overlapAt().
+    // b gets registered before a, which keeps the string ids (and thus the ordering of the output) as they were.
+    template<typename callbacktype>
+    void criticalPairs(rule large, rule small, const callbacktype &fct) const {
+        if (ss->strings[large.first].size() < ss->strings[small.first].size()) { // this is not about complexity, it is about length
+            std::swap(large, small);
+        }
+
+        int s1size = ss->strings[large.first].size();
+        int s2size = ss->strings[small.first].size();
+
+        for (int offset = 1 - s2size; offset < s1size; ++offset) {
+            const auto s1 = ss->strings[large.first];
+            const auto s2 = ss->strings[small.first];
+            int l = s2.size();
+            if (offset < 0) {
+                l += offset;
+            }
+            if (offset + s2.size() > s1.size()) {
+                l -= (offset + (int) s2.size() - (int) s1.size());
+            }
+            //prt2(large.first, strings.size());
+            //prt6(offset, l, s1.size(), s2.size(), toString(s1),toString(s2));
+            assert(l);
+            const auto large_overlapbegin = s1.begin() + std::max(0, offset);
+            const auto large_overlapend = large_overlapbegin + l;
+            const auto small_overlapbegin = s2.begin() + std::max(0, -offset);
+            const auto small_overlapend = small_overlapbegin + l;
+            if (symbolsEqual(large_overlapbegin,
+                             large_overlapend,
+                             small_overlapbegin,
+                             small_overlapend,
+                             ss->eq)) {
+                //std::cerr << "large rule: " << toString(strings[large.first]) << " --> " << toString(strings[large.second]) << std::endl;
+                //std::cerr << "small rule: " << toString(strings[small.first]) << " --> " << toString(strings[small.second]) << std::endl;
+                if (offset < 0) {
+                    overlapAt(small, large, -offset, fct);
+                } else {
+                    overlapAt(large, small, offset, fct);
+                }
+            }
+        }
+    }
+
+    // An overlap of the left hand side of v at position offset in the one of u, see overlapAt().
+    struct Overlap {
+        rule u, v;
+        int offset;
+    };
+
+    // When set, tryDeduce looks the overlaps up in actree instead of trying every offset of every pair of rules:
+    // per rule the rules that start with one of its suffixes and the rules that contain it. Every overlap gets found
+    // once, from the side of the rule that ends first. The critical pairs are the same, in another order.
+    // The index takes the place of overlapping all pairs, so it doesn't combine with incremental_deduction: run()
+    // asserts that not both are set, and update() sticks to the index instead of switching to incremental_deduction.
+    bool overlap_index = false;
+
+    std::vector <Overlap> indexedOverlaps() {
+        std::vector <Overlap> ret;
+        for (const auto &r : current_rules) {
+            const auto lhs = ss->strings[r.first];
+            actree.iterate_suffix_overlaps(lhs.begin(), lhs.end(), [&](const rules &others, const std::size_t overlap) {
+                for (const auto &o : others) {
+                    ret.push_back(Overlap{r, o, (int) (lhs.size() - overlap)});
+                }
+            });
+            actree.iterate_superstrings(lhs.begin(), lhs.end(), [&](const rules &others, const std::size_t offset) {
+                for (const auto &o : others) {
+                    // the same left hand side contains it both ways, take that one once.
+                    if (offset || ss->strings[o.first].size() != lhs.size() || r < o) {
+                        ret.push_back(Overlap{o, r, (int) offset});
+                    }
+                }
+            });
+        }
+        return ret;
+    }
+
+    void addCriticalPair(const stringid a, const stringid b) {
+        const equality new_identity = orderIdentity(std::make_pair(a, b)); // == a critical pair
+        const bool kept = new_identity.first != new_identity.second && current_identities.find(new_identity) == current_identities.end();
+        if (kept) {
+            //std::cerr << "critical pair: " << toString(strings[new_identity.first]) << " == " << toString(strings[new_identity.second]) << std::endl;
+            if (max_identity_length && std::max(ss->strings[a].size(), ss->strings[b].size()) > max_identity_length) {
+                postponeIdentity(new_identity);
+            } else {
+                insertIdentity(new_identity);
+            }
+        }
+        stats.criticalPair(kept);
+    }
+
+    // Computes all critical pairs between the left hand sides of 2 rules and stores the non-trivial ones as identities.
+    void deducePair(const rule &a, const rule &b) {
+        criticalPairs(a, b, [&](const stringtype &cp1, const auto &cp2) {
+            const stringid second = reduceCopyRegister(cp2);
+            addCriticalPair(reduceCopyRegister(cp1), second);
+        });
+    }
+
+    // When larger than 1, the rule pairs of a deduction phase get spread over this many threads.
+    unsigned deduce_threads = 1;
+
+    // Registers the critical pairs that produce(i, fct) reports for every i in [0, count).
+    // The workers only read from the automaton and the strings, they collect the reduced critical pairs per i.
+    // Those are registered afterwards in the order of i, so the string ids and the resulting identities don't
+    // depend on the amount of threads.
+    template<typename producertype>
+    void deduceEach(const std::size_t count, const producertype &produce) {
+        if (deduce_threads <= 1 || count < 2) {
+            for (std::size_t i = 0; i < count; ++i) {
+                produce(i, [&](const stringtype &cp1, const auto &cp2) {
+                    const stringid second = reduceCopyRegister(cp2);
+                    addCriticalPair(reduceCopyRegister(cp1), second);
+                });
+            }
+            return;
+        }
+        actree.updateLinks(); // from here on the automaton is read-only.
+        std::vector <std::vector<std::pair<stringtype, stringtype>>> results(count);
+        parallelFor(count, deduce_threads, [&](const std::size_t i) {
+            produce(i, [&](const stringtype &cp1, const auto &cp2) {
+                results[i].emplace_back(reduceCopy(cp1).first, reduceCopy(cp2.begin(), cp2.end()).first);
+            });
+        });
+        for (const auto &r : results) {
+            for (const auto &cp : r) {
+                const stringid second = getOrCreateString(cp.second);
+                addCriticalPair(getOrCreateString(cp.first), second);
+            }
+        }
+    }
+
+    void deducePairs(const std::vector <std::pair<rule, rule>> &pairs) {
+        deduceEach(pairs.size(), [&](const std::size_t i, const auto &fct) {
+            criticalPairs(pairs[i].first, pairs[i].second, fct);
+        });
+    }
+
     void tryDeduce() {
+        if (overlap_index) {
+            const auto overlaps = indexedOverlaps();
+            deduceEach(overlaps.size(), [&](const std::size_t i, const auto &fct) {
+                overlapAt(overlaps[i].u, overlaps[i].v, overlaps[i].offset, fct);
+            });
+            return;
+        }
+        std::vector <std::pair<rule, rule>> pairs;
         for (auto i = current_rules.begin(); i != current_rules.end(); ++i) {
-            auto j = i;
-            ++j;
+            auto j = i; // a rule overlaps with itself too, like aba with itself in abab.
             for (; j != current_rules.end(); ++j) {
-                rule large = *i;
-                rule small = *j;
-                if (ss->strings[large.first].size() < ss->strings[small.first].size()) { // this is not about complexity, it is about length
-                    std::swap(large, small);
-                }
+                pairs.emplace_back(*i, *j);
+            }
+        }
+        deducePairs(pairs);
+    }
 
-                int s1size = ss->strings[large.first].size();
-                int s2size = ss->strings[small.first].size();
+    // Incremental alternative for tryDeduce: only the pairs queued by addRule are overlapped, shortest first.
+    // Pairs whose rules got composed or collapsed away in the meantime are dropped.
+    void tryDeducePending() {
+        std::vector <std::pair<rule, rule>> pairs;
+        for (const auto &p : pending_pairs) {
+            if (current_rules.find(p.a) != current_rules.end() && current_rules.find(p.b) != current_rules.end()) {
+                pairs.emplace_back(p.a, p.b);
+            }
+        }
+        pending_pairs.clear();
+        deducePairs(pairs);
+    }
 
-                for (int offset = 1 - s2size; offset < s1size; ++offset) {
-                    const auto &s1 = ss->strings[large.first]; // these need to be within the loop because the content of strings gets modified during the iterations. Though ... with a deque i dont expect much issues.
-                    const auto &s2 = ss->strings[small.first];
-                    int l = s2.size();
-                    if (offset < 0) {
-                        l += offset;
-                    }
-                    if (offset + s2.size() > s1.size()) {
-                        l -= (offset + (int) s2.size() - (int) s1.size());
-                    }
-                    //prt2(large.first, strings.size());
-                    //prt6(offset, l, s1.size(), s2.size(), toString(s1),toString(s2));
-                    assert(l);
-                    const auto large_overlapbegin = s1.begin() + std::max(0, offset);
-                    const auto large_overlapend = large_overlapbegin + l;
-                    const auto small_overlapbegin = s2.begin() + std::max(0, -offset);
-                    const auto small_overlapend = small_overlapbegin + l;
-                    if (std::equal(large_overlapbegin,
-                                   large_overlapend,
-                                   small_overlapbegin,
-                                   small_overlapend,
-                                   ss->eq)) {
-                        equality new_identity; // == a critical pair
-                        if (offset < 0) {
-                            stringtype cp1(s2.begin(), small_overlapbegin);
-                            cp1.insert(cp1.end(), ss->strings[large.second].begin(), ss->strings[large.second].end());
-                            stringtype cp2(ss->strings[small.second]);
-                            cp2.insert(cp2.end(), large_overlapend, s1.end());
-                            new_identity = std::make_pair(reduceCopyRegister(cp1), reduceCopyRegister(cp2));
-                        } else if (offset + s2.size() > s1.size()) {
-
-                            stringtype cp1(s1.begin(), large_overlapbegin);
-                            cp1.insert(cp1.end(), ss->strings[small.second].begin(), ss->strings[small.second].end());
-                            stringtype cp2(ss->strings[large.second]);
-                            cp2.insert(cp2.end(), small_overlapend, s2.end());
-
-                            new_identity = std::make_pair(reduceCopyRegister(cp1), reduceCopyRegister(cp2));
-
-                        } else {
-                            stringtype cp1(s1.begin(), s1.begin() + std::max(0, offset));
-                            cp1.insert(cp1.end(), ss->strings[small.second].begin(), ss->strings[small.second].end());
-                            cp1.insert(cp1.end(), s1.begin() + std::max(0, offset) + l, s1.end());
-                            new_identity.first = reduceCopyRegister(ss->strings[large.second]);
-                            new_identity.second = reduceCopyRegister(cp1);
-                        }
-                        new_identity = orderIdentity(new_identity);
-                        //std::cerr << "large rule: " << toString(strings[large.first]) << " --> " << toString(strings[large.second]) << std::endl;
-                        //std::cerr << "small rule: " << toString(strings[small.first]) << " --> " << toString(strings[small.second]) << std::endl;
-                        if (new_identity.first != new_identity.second && current_identities.find(new_identity) == current_identities.end()) {
-                            //std::cerr << "critical pair: " << toString(strings[new_identity.first]) << " == " << toString(strings[new_identity.second]) << std::endl;
-                            current_identities.insert(new_identity);
-                        }
+    // Marks the strings used by the inputs, the identities and the rules.
+    void markStrings(std::vector<bool> &keep) const {
+        for (const auto *pairs : {&input_identities, &current_identities, &current_rules, &postponed_identities}) {
+            for (const auto &p : *pairs) {
+                keep[p.first] = true;
+                keep[p.second] = true;
+            }
+        }
+    }
 
-                    }
-                }
+    // Follows a renumbering by StringStorage::compact(). Pending pairs of rules that are gone get dropped. The ids are
+    // part of the state hashes, so of the loop detection history only the current state survives.
+    void remapStrings(const std::vector <stringid> &remap) {
+        const auto remapped = [&](const std::set <std::pair<stringid, stringid>> &pairs) {
+            std::set <std::pair<stringid, stringid>> ret;
+            for (const auto &p : pairs) {
+                ret.insert(ret.end(), std::make_pair(remap[p.first], remap[p.second])); // the order doesn't change.
+            }
+            return ret;
+        };
+        input_identities = remapped(input_identities);
+        current_identities = remapped(current_identities);
+        current_rules = remapped(current_rules);
+        postponed_identities = remapped(postponed_identities);
+        normal_forms.clear();
+        for (auto &n : actree.nodes) {
+            if (n.payload) {
+                *n.payload = remapped(*n.payload);
             }
         }
+        std::set <PendingPair> pending;
+        const stringid gone = stringstoragetype::empty_slot;
+        for (const auto &p : pending_pairs) {
+            const rule a(remap[p.a.first], remap[p.a.second]);
+            const rule b(remap[p.b.first], remap[p.b.second]);
+            if (a.first != gone && a.second != gone && b.first != gone && b.second != gone) {
+                pending.insert(PendingPair{p.weight, a, b});
+            }
+        }
+        pending_pairs.swap(pending);
+        std::vector <typename orderingtype::keytype> keys;
+        for (std::size_t i = 0; i < ordering_keys.size(); ++i) {
+            if (remap[i] != gone) {
+                keys.push_back(ordering_keys[i]);
+            }
+        }
+        ordering_keys.swap(keys);
+        recomputeFingerprint();
+        hashed_states.clear();
+        hashed_states.insert(stateHash());
     }
 
+    // For a completion that has the storage to itself, see collectStringGarbage().
+    std::size_t collectStringGarbage() {
+        return ::collectStringGarbage(*ss, *this);
+    }
+
+    // Set by update(): the rules are confluent for input_identities already, reducing those again every cycle is waste.
+    bool inputs_settled = false;
+
     void introduceInputs() {
-        current_identities.insert(input_identities.begin(), input_identities.end());
+        if (inputs_settled) {
+            return;
+        }
+        for (const auto &e : input_identities) {
+            insertIdentity(e);
+        }
+    }
+
+    Bits128 stateHash() const {
+        return state_fingerprint;
     }
 
     bool cycleOnce() {
+        ++cycle_count;
+        const Bits128 start_state = stateHash();
+        const std::size_t start_changes = state_changes;
 
-        introduceInputs();
+        timed(phase_introduce, [&] { introduceInputs(); });
 
-        tryDelete();
+        timed(phase_delete, [&] { tryDelete(); });
 
-        tryCompose();
-        trySimplify();
-        tryOrient();
+        timed(phase_compose, [&] { tryCompose(); });
+        timed(phase_simplify, [&] { trySimplify(); });
+        timed(phase_orient, [&] { tryOrient(); });
 
         //tryCollapse();
         //tryObsolete();
-        tryCollapseAttempt2();
-        tryDeduce();
-        {
-            Bits128 state_hash;
-            // copy all state in one contiguous slab of memory. The strings themselves dont go in there so it cant be heavy.
-            std::vector <rule> data(current_rules.begin(), current_rules.end());
-            data.insert(data.end(), current_identities.begin(), current_identities.end());
-            MurmurHash3_x64_128(data.data(), data.size() * sizeof(rule), 42, &state_hash);
-            if (hashed_states.find(state_hash) != hashed_states.end()) {
-                return false; // finished simulation, we had this state before.
+        timed(phase_collapse, [&] {
+            tryCollapseAttempt2();
+            actree.sweep(); // compose and collapse only empty the payloads of the rules they remove.
+        });
+        timed(phase_deduce, [&] {
+            if (incremental_deduction) {
+                assert(!overlap_index); // see overlap_index.
+                tryDeducePending();
+            } else {
+                tryDeduce();
             }
-            hashed_states.insert(state_hash);
-        }
+            limitActiveIdentities();
+        });
+        bool seen_before = false;
+        timed(phase_loopdetection, [&] {
+            if (fixpoint_detection_only) {
+                seen_before = state_changes == start_changes || stateHash() == start_state;
+            } else {
+                seen_before = !hashed_states.insert(stateHash()).second;
+            }
+            if (seen_before && releasePostponed()) {
+                seen_before = false;
+            }
+        });
+        stats.cycleDone(*this);
 
-        return true;
+        return !seen_before; // when false: finished simulation, we had this state before.
     }
 
     bool run(const int maxcycles = 1000) {
         int n = 0;
         while (true) {
-            if (++n > maxcycles) {
+            if (++n > maxcycles || (stop_requested && stop_requested->load())) {
+                checkpoint();
                 return false;
             }
             if (!cycleOnce()) {
+                checkpoint();
                 return true;
             }
+            if (collect_strings_every && cycle_count % collect_strings_every == 0) {
+                collectStringGarbage();
+            }
+            if (checkpoint_every && cycle_count % checkpoint_every == 0) {
+                checkpoint();
+            }
         }
         return current_identities.empty(); // if we did not manage to melt away all identities then we wont have a confluent rewriting system.
     }
 
+    // For relations that arrive after the completion ran: both sides get reduced by the current rules first, an identity
+    // that already follows from them is dropped (returns false). The reduced one goes straight into current_identities
+    // rather than input_identities, so no later cycle has to introduce it again. Then update() completes.
+    bool ingestIdentity(const equality &e) {
+        const equality reduced(normalForm(e.first), normalForm(e.second));
+        if (reduced.first == reduced.second) {
+            return false;
+        }
+        const bool inserted = insertIdentity(orderIdentity(reduced));
+        if (invariants && !preservesInvariants(reduced)) {
+            detectInvariants();
+        }
+        return inserted;
+    }
+
+    bool ingestIdentity(const stringtype &a, const stringtype &b) {
+        return ingestIdentity(std::make_pair(getOrCreateString(a), getOrCreateString(b)));
+    }
+
+    // Completes again after ingestIdentity(), for a completion whose last run() returned true. All pairs of the rules
+    // present got overlapped by then, so this switches to incremental_deduction: only the rules that come out of the
+    // new identities get overlapped, with each other and with the rest. The inputs don't get introduced again.
+    // With overlap_index set every cycle looks up all overlaps in the index as before.
+    bool update(const int maxcycles = 1000) {
+        incremental_deduction = !overlap_index;
+        inputs_settled = true;
+        return run(maxcycles);
+    }
+
+    std::size_t cycle_count = 0; // over all calls to run().
+
+    // When set, run() gives up (and returns false) before the next cycle as soon as this becomes true. For stopping a
+    // completion from another thread.
+    const std::atomic<bool> *stop_requested = nullptr;
+
+    // With collect_strings_every set, run() drops the strings nothing refers to anymore every that many cycles.
+    // Only for a completion that doesn't share its storage with others, those would lose their strings.
+    unsigned collect_strings_every = 0;
+
+    // With checkpoint_every set, run() writes the complete state of the completion to checkpoint_path every that many
+    // cycles and when it returns. A completion that got interrupted can then be continued with loadCheckpoint().
+    // The symbols get written byte for byte, so only trivially copyable symbols can be checkpointed. For others
+    // writeCheckpoint() and loadCheckpoint() return false.
+    std::string checkpoint_path;
+    unsigned checkpoint_every = 0;
+    std::size_t failed_checkpoints = 0; // a checkpoint that can't be written doesn't stop the completion.
+
+    static constexpr const char *checkpoint_magic = "KBCHKPT";
+    static const uint32_t checkpoint_version = 3; // 2: hashed_states holds fingerprints, see stateHash(). 3: postponed identities.
+
+    enum {
+        checkpoint_string_offsets, // strings + 1 entries, string i runs from offset i to offset i + 1 in the symbols.
+        checkpoint_string_symbols,
+        checkpoint_input_identities,
+        checkpoint_current_identities,
+        checkpoint_current_rules,
+        checkpoint_hashed_states,
+        checkpoint_pending_pairs,
+        checkpoint_counters, // cycle_count, incremental_deduction
+        checkpoint_postponed_identities,
+        checkpoint_section_count
+    };
+
+    struct StoredPair {
+        uint64_t first, second;
+    };
+
+    struct StoredPendingPair {
+        uint64_t weight;
+        StoredPair a, b;
+    };
+
+    void checkpoint() {
+        if (checkpoint_every && !writeCheckpoint(checkpoint_path)) {
+            ++failed_checkpoints;
+        }
+    }
+
+    // The file gets written next to path first and then renamed, so an interruption never leaves a broken checkpoint.
+    bool writeCheckpoint(const std::string &path) const {
+        return writeCheckpoint(path, std::is_trivially_copyable<symboltype>());
+    }
+
+    bool writeCheckpoint(const std::string &, std::false_type) const {
+        return false;
+    }
+
+    bool writeCheckpoint(const std::string &path, std::true_type) const {
+        std::vector <uint64_t> offsets(1, 0);
+        std::vector <symboltype> symbols;
+        for (const auto &s : ss->strings) {
+            symbols.insert(symbols.end(), s.begin(), s.end());
+            offsets.push_back(symbols.size());
+        }
+        const auto stored = [](const std::set <std::pair<stringid, stringid>> &pairs) {
+            std::vector <StoredPair> ret;
+            for (const auto &p : pairs) {
+                ret.push_back(StoredPair{(uint64_t) p.first, (uint64_t) p.second});
+            }
+            return ret;
+        };
+        const auto inputs = stored(input_identities);
+        const auto identities = stored(current_identities);
+        const auto rules_ = stored(current_rules);
+        const auto postponed = stored(postponed_identities);
+        const std::vector <Bits128> states(hashed_states.begin(), hashed_states.end());
+        std::vector <StoredPendingPair> pending;
+        for (const auto &p : pending_pairs) {
+            pending.push_back(StoredPendingPair{p.weight,
+                                               StoredPair{(uint64_t) p.a.first, (uint64_t) p.a.second},
+                                               StoredPair{(uint64_t) p.b.first, (uint64_t) p.b.second}});
+        }
+        const std::vector <uint64_t> counters{cycle_count, incremental_deduction};
+
+        SectionFileWriter w;
+        w.add(offsets);
+        w.add(symbols);
+        w.add(inputs);
+        w.add(identities);
+        w.add(rules_);
+        w.add(states);
+        w.add(pending);
+        w.add(counters);
+        w.add(postponed);
+        const std::string tmp = path + ".tmp";
+        return w.write(tmp, checkpoint_magic, checkpoint_version, sizeof(symboltype)) && std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    // Replaces the state of this completion with the one from a checkpoint. The strings get interned in ss, which
+    // doesn't need to be empty. If that changes their ids, the hashed states are useless and loop detection starts over.
+    // The ordering isnt part of the checkpoint, the completion has to be constructed with the same one as before.
+    // When the file can't be used, false is returned and the completion is left as it was.
+    bool loadCheckpoint(const std::string &path) {
+        return loadCheckpoint(path, std::is_trivially_copyable<symboltype>());
+    }
+
+    bool loadCheckpoint(const std::string &, std::false_type) {
+        return false;
+    }
+
+    bool loadCheckpoint(const std::string &path, std::true_type) {
+        MappedSectionFile f;
+        if (!f.open(path, checkpoint_magic, checkpoint_version, sizeof(symboltype)) || f.sectionCount() != checkpoint_section_count) {
+            return false;
+        }
+        const uint64_t *offsets, *counters;
+        const symboltype *symbols;
+        const StoredPair *inputs, *identities, *rules_, *postponed;
+        const Bits128 *states;
+        const StoredPendingPair *pending;
+        std::size_t offsetcount, symbolcount, inputcount, identitycount, rulecount, statecount, pendingcount, countercount, postponedcount;
+        if (!f.section(checkpoint_string_offsets, offsets, offsetcount)
+            || !f.section(checkpoint_string_symbols, symbols, symbolcount)
+            || !f.section(checkpoint_input_identities, inputs, inputcount)
+            || !f.section(checkpoint_current_identities, identities, identitycount)
+            || !f.section(checkpoint_current_rules, rules_, rulecount)
+            || !f.section(checkpoint_hashed_states, states, statecount)
+            || !f.section(checkpoint_pending_pairs, pending, pendingcount)
+            || !f.section(checkpoint_counters, counters, countercount)
+            || !f.section(checkpoint_postponed_identities, postponed, postponedcount)
+            || offsetcount == 0 || countercount != 2 || offsets[0] != 0) {
+            return false;
+        }
+        const std::size_t stringcount = offsetcount - 1;
+        for (std::size_t i = 0; i < stringcount; ++i) {
+            if (offsets[i] > offsets[i + 1] || offsets[i + 1] > symbolcount) {
+                return false;
+            }
+        }
+        const auto valid = [&](const StoredPair *pairs, const std::size_t count) {
+            for (std::size_t i = 0; i < count; ++i) {
+                if (pairs[i].first >= stringcount || pairs[i].second >= stringcount) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        if (!valid(inputs, inputcount) || !valid(identities, identitycount) || !valid(rules_, rulecount) || !valid(postponed, postponedcount)) {
+            return false;
+        }
+        for (std::size_t i = 0; i < pendingcount; ++i) {
+            if (!valid(&pending[i].a, 1) || !valid(&pending[i].b, 1)) {
+                return false;
+            }
+        }
+
+        std::vector <stringid> ids(stringcount);
+        bool same_ids = true;
+        for (std::size_t i = 0; i < stringcount; ++i) {
+            ids[i] = getOrCreateString(symbols + offsets[i], symbols + offsets[i + 1]);
+            same_ids = same_ids && ids[i] == (stringid) i;
+        }
+        const auto restored = [&](const StoredPair &p) {
+            return std::make_pair(ids[p.first], ids[p.second]);
+        };
+
+        input_identities.clear();
+        current_identities.clear();
+        current_rules.clear();
+        postponed_identities.clear();
+        normal_forms.clear();
+        actree = automatontype(ss->comp);
+        hashed_states.clear();
+        pending_pairs.clear();
+        for (std::size_t i = 0; i < inputcount; ++i) {
+            input_identities.insert(restored(inputs[i]));
+        }
+        for (std::size_t i = 0; i < identitycount; ++i) {
+            current_identities.insert(restored(identities[i]));
+        }
+        for (std::size_t i = 0; i < postponedcount; ++i) {
+            postponed_identities.insert(restored(postponed[i]));
+        }
+        for (std::size_t i = 0; i < rulecount; ++i) {
+            const rule r = restored(rules_[i]);
+            current_rules.insert(r);
+            actree.getOrCreate(ss->strings[r.first].begin(), ss->strings[r.first].end()).insert(r);
+        }
+        recomputeFingerprint();
+        if (same_ids) {
+            hashed_states.insert(states, states + statecount);
+        }
+        for (std::size_t i = 0; i < pendingcount; ++i) {
+            pending_pairs.insert(PendingPair{pending[i].weight, restored(pending[i].a), restored(pending[i].b)});
+        }
+        cycle_count = counters[0];
+        incremental_deduction = counters[1] != 0;
+        return true;
+    }
+
 
 };
 
 
+template<typename symbolinfo, typename stringid, typename statstype, typename orderingtype>
+constexpr const char *KnuthBendixCompletion<symbolinfo, stringid, statstype, orderingtype>::checkpoint_magic;
+
+template<typename symbolinfo, typename stringid, typename statstype, typename orderingtype>
+const uint32_t KnuthBendixCompletion<symbolinfo, stringid, statstype, orderingtype>::checkpoint_version;
+
 #endif
@@ -0,0 +1,83 @@
+#ifndef LIVE_REWRITE_SYSTEM_HPP
+#define LIVE_REWRITE_SYSTEM_HPP
+
+#include "compiled_rewrite_system.hpp"
+#include <memory>
+#include <mutex>
+
+// Serves queries from a completed system while new relations keep coming in. Queries go to a compiled snapshot of the
+// rules. ingest() only queues a relation, and commit() feeds the queue to the completion (see
+// KnuthBendixCompletion::ingestIdentity and update) and then publishes a new snapshot. Until then the previous snapshot
+// keeps answering, and a reader that holds on to a snapshot keeps it alive after the swap.
+//
+// Any number of threads can query and ingest. The completion and its storage belong to commit(), which runs one at a
+// time: that's why ingest() queues the relation as symbols and leaves interning it to commit().
+template<typename symbolinfo, typename stringid, typename statstype = NoCompletionStats, typename orderingtype = ShortLexOrdering>
+class LiveRewriteSystem {
+public:
+    typedef typename symbolinfo::stringtype stringtype;
+    typedef KnuthBendixCompletion<symbolinfo, stringid, statstype, orderingtype> completiontype;
+    typedef CompiledRewriteSystem<symbolinfo> systemtype;
+
+private:
+    completiontype &kbc;
+    std::shared_ptr<const systemtype> current; // only through std::atomic_load and std::atomic_store.
+    uint64_t published_generation;
+    std::mutex pending_mutex;
+    std::vector <std::pair<stringtype, stringtype>> pending;
+    std::mutex commit_mutex;
+
+    void publish() {
+        std::atomic_store(&current, std::shared_ptr<const systemtype>(std::make_shared<systemtype>(kbc)));
+        published_generation = kbc.rules_generation;
+    }
+
+public:
+    int maxcycles = 1000; // per commit.
+
+    // kbc is supposed to have completed, see KnuthBendixCompletion::update.
+    explicit LiveRewriteSystem(completiontype &kbc) : kbc(kbc) {
+        publish();
+    }
+
+    std::shared_ptr<const systemtype> snapshot() const {
+        return std::atomic_load(&current);
+    }
+
+    std::pair<stringtype, bool> reduceCopy(const stringtype &s) const {
+        return snapshot()->reduceCopy(s);
+    }
+
+    void ingest(const stringtype &a, const stringtype &b) {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        pending.emplace_back(a, b);
+    }
+
+    std::size_t pendingCount() {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        return pending.size();
+    }
+
+    // Returns whether the snapshot is up to date with everything ingested before the call. When the completion doesn't
+    // get confluent within maxcycles the previous snapshot stays, the next commit continues from where this one stopped.
+    bool commit() {
+        std::lock_guard<std::mutex> lock(commit_mutex);
+        std::vector <std::pair<stringtype, stringtype>> batch;
+        {
+            std::lock_guard<std::mutex> pending_lock(pending_mutex);
+            batch.swap(pending);
+        }
+        for (const auto &e : batch) {
+            kbc.ingestIdentity(e.first, e.second);
+        }
+        if (!kbc.update(maxcycles) || !kbc.confluent()) {
+            return false;
+        }
+        if (kbc.rules_generation != published_generation) {
+            publish();
+        }
+        return true;
+    }
+};
+
+#endif
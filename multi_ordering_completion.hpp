@@ -0,0 +1,94 @@
+#ifndef MULTI_ORDERING_COMPLETION_HPP
+#define MULTI_ORDERING_COMPLETION_HPP
+
+#include "knuth_bendix.hpp"
+#include <functional>
+#include <memory>
+
+// Runs the completion of one set of identities for many complexity orderings at once, each ordering a job on a pool of
+// threads. All jobs share one storage, made concurrent by run(): the identities get interned once, and any string that
+// comes up under several orderings is stored once with the same id for all of them, so results can be compared by id.
+//
+// With a goal set, the first job that completes to a confluent system for which goal(kbc) holds stops the others:
+// jobs that are running give up before their next cycle, jobs that didn't start yet are skipped.
+template<typename symbolinfo, typename stringid, typename orderingtype, typename statstype = NoCompletionStats>
+struct MultiOrderingCompletion {
+    typedef typename symbolinfo::stringtype stringtype;
+    typedef KnuthBendixCompletion<symbolinfo, stringid, statstype, orderingtype> completiontype;
+    typedef typename completiontype::stringstoragetype stringstoragetype;
+    typedef typename completiontype::equality equality;
+
+    struct Result {
+        std::unique_ptr <completiontype> kbc; // null for a job that got skipped.
+        bool completed = false; // reached a fixpoint within maxcycles.
+        bool confluent = false; // completed without identities left over.
+        bool goal_met = false;
+    };
+
+    stringstoragetype storage;
+    std::vector <equality> identities;
+    std::vector <orderingtype> orderings;
+    std::vector <Result> results; // per ordering, filled by run().
+
+    std::function<bool(completiontype &)> goal;
+    unsigned threads = 1;
+    int maxcycles = 1000;
+
+    static constexpr std::size_t none = std::numeric_limits<std::size_t>::max();
+    std::size_t winner = none; // the lowest ordering that met the goal.
+
+    // Set once a job met the goal. The jobs only look at it while run() runs, completions taken from results don't.
+    std::atomic<bool> stop{false};
+
+    void addIdentity(const stringtype &a, const stringtype &b) {
+        identities.emplace_back(storage.getOrCreateString(a), storage.getOrCreateString(b));
+    }
+
+    void addOrdering(const orderingtype &o) {
+        orderings.push_back(o);
+    }
+
+    // Returns whether some ordering met the goal, or without a goal whether all of them ended confluent.
+    bool run() {
+        results.clear();
+        results.resize(orderings.size());
+        winner = none;
+        if (!storage.concurrent()) {
+            storage.makeConcurrent();
+        }
+        stop.store(false);
+        parallelFor(orderings.size(), threads, [&](const std::size_t i) {
+            if (stop.load()) {
+                return;
+            }
+            Result &r = results[i];
+            r.kbc.reset(new completiontype(&storage, orderings[i]));
+            for (const auto &e : identities) {
+                r.kbc->addIdentity(e);
+            }
+            if (goal) {
+                r.kbc->stop_requested = &stop;
+            }
+            r.completed = r.kbc->run(maxcycles);
+            r.kbc->stop_requested = nullptr;
+            r.confluent = r.completed && r.kbc->confluent();
+            r.goal_met = r.confluent && goal && goal(*r.kbc);
+            if (r.goal_met) {
+                stop.store(true);
+            }
+        }, 1);
+        bool all_confluent = true;
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            if (results[i].goal_met && winner == none) {
+                winner = i;
+            }
+            all_confluent = all_confluent && results[i].confluent;
+        }
+        return goal ? winner != none : all_confluent;
+    }
+};
+
+template<typename symbolinfo, typename stringid, typename orderingtype, typename statstype>
+constexpr std::size_t MultiOrderingCompletion<symbolinfo, stringid, orderingtype, statstype>::none;
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef NORMAL_FORM_CACHE_HPP
+#define NORMAL_FORM_CACHE_HPP
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+// Memo of normal forms by string id, with at most capacity entries: the least recently used one makes way for a new one.
+// An entry holds the generation of the rules it was computed under and only counts as a hit for that same generation,
+// so a change of the rules invalidates everything at once without touching the entries. Stale ones just age out.
+template<typename stringid>
+class NormalFormCache {
+    struct Entry {
+        stringid string;
+        stringid normal_form;
+        uint64_t generation;
+    };
+
+    std::list <Entry> entries; // most recently used first.
+    std::unordered_map <stringid, typename std::list<Entry>::iterator> index;
+
+public:
+    std::size_t capacity = 0; // 0 disables the cache.
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+
+    bool enabled() const {
+        return capacity != 0;
+    }
+
+    // true with the normal form in normal_form when s is known under this generation.
+    bool find(const stringid s, const uint64_t generation, stringid &normal_form) {
+        const auto it = index.find(s);
+        if (it == index.end() || it->second->generation != generation) {
+            ++misses;
+            return false;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        normal_form = it->second->normal_form;
+        ++hits;
+        return true;
+    }
+
+    void insert(const stringid s, const uint64_t generation, const stringid normal_form) {
+        const auto it = index.find(s);
+        if (it != index.end()) {
+            it->second->normal_form = normal_form;
+            it->second->generation = generation;
+            entries.splice(entries.begin(), entries, it->second);
+            return;
+        }
+        if (entries.size() >= capacity) {
+            index.erase(entries.back().string);
+            entries.pop_back();
+        }
+        entries.push_front(Entry{s, normal_form, generation});
+        index.emplace(s, entries.begin());
+    }
+
+    // for when the string ids change.
+    void clear() {
+        entries.clear();
+        index.clear();
+    }
+
+    std::size_t size() const {
+        return entries.size();
+    }
+
+    std::size_t memoryUsage() const {
+        return entries.size() * (sizeof(Entry) + 2 * sizeof(void *)) + index.size() * (sizeof(stringid) + 3 * sizeof(void *)) + index.bucket_count() * sizeof(void *);
+    }
+};
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef ORDERINGS_HPP
+#define ORDERINGS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+#include "packed_symbols.hpp"
+
+// Complexity orderings for KnuthBendixCompletion, its fourth template parameter.
+// An ordering summarises every string in a key, which the completion computes once per string and keeps next to its
+// id. Most comparisons are then settled by compareKeys, an integer compare. Only when that returns 0 the strings
+// themselves get compared with less().
+// An ordering provides:
+//     typedef ... keytype;
+//     keytype key(const stringtype &s) const;
+//     int compareKeys(const keytype &a, const keytype &b) const; // <0, >0 or 0 when the keys don't decide.
+//     bool less(const stringtype &a, const stringtype &b, const symbolless &comp) const; // comp orders the symbols.
+
+struct NoOrderingKey {
+};
+
+// Shorter strings first, strings of the same length are ordered lexicographically. The default.
+struct ShortLexOrdering {
+    typedef std::size_t keytype;
+
+    template<typename stringtype>
+    keytype key(const stringtype &s) const {
+        return s.size();
+    }
+
+    int compareKeys(const keytype a, const keytype b) const {
+        return a < b ? -1 : (b < a ? 1 : 0);
+    }
+
+    template<typename stringtype, typename symbolless>
+    bool less(const stringtype &a, const stringtype &b, const symbolless &comp) const {
+        return symbolsLess(a.begin(), a.end(), b.begin(), b.end(), comp);
+    }
+};
+
+// Strings with a smaller total weight first, then shortlex. Symbols without a weight weigh default_weight.
+template<typename symboltype>
+struct WeightedShortLexOrdering {
+    struct keytype {
+        uint64_t weight;
+        std::size_t length;
+    };
+
+    std::map <symboltype, uint64_t> weights;
+    uint64_t default_weight = 1;
+
+    WeightedShortLexOrdering() = default;
+
+    explicit WeightedShortLexOrdering(const std::map <symboltype, uint64_t> &weights_, const uint64_t default_weight_ = 1) :
+            weights(weights_), default_weight(default_weight_) {
+    }
+
+    template<typename stringtype>
+    keytype key(const stringtype &s) const {
+        keytype ret{0, s.size()};
+        for (const auto &c : s) {
+            const auto it = weights.find(c);
+            ret.weight += it == weights.end() ? default_weight : it->second;
+        }
+        return ret;
+    }
+
+    int compareKeys(const keytype &a, const keytype &b) const {
+        if (a.weight != b.weight) {
+            return a.weight < b.weight ? -1 : 1;
+        }
+        if (a.length != b.length) {
+            return a.length < b.length ? -1 : 1;
+        }
+        return 0;
+    }
+
+    template<typename stringtype, typename symbolless>
+    bool less(const stringtype &a, const stringtype &b, const symbolless &comp) const {
+        return symbolsLess(a.begin(), a.end(), b.begin(), b.end(), comp);
+    }
+};
+
+// Recursive path ordering on strings, comparing from the right. With u = u'a and v = v'b:
+//     u < v  iff  (a == b and u' < v') or (a < b and u' < v) or (b < a and u <= v')
+// and the empty string is the smallest one. A larger symbol outweighs any amount of smaller ones, so this ordering is
+// not compatible with length and there is no key.
+struct RecursivePathOrdering {
+    typedef NoOrderingKey keytype;
+
+    template<typename stringtype>
+    keytype key(const stringtype &) const {
+        return keytype();
+    }
+
+    int compareKeys(const keytype &, const keytype &) const {
+        return 0;
+    }
+
+    template<typename stringtype, typename symbolless>
+    bool less(const stringtype &a, const stringtype &b, const symbolless &comp) const {
+        return lessPrefix(a.begin(), a.size(), b.begin(), b.size(), comp);
+    }
+
+    // compares the prefixes of lengths alen and blen.
+    template<typename iteratortype, typename symbolless>
+    static bool lessPrefix(const iteratortype &a, const std::size_t alen, const iteratortype &b, const std::size_t blen, const symbolless &comp) {
+        if (blen == 0) {
+            return false;
+        }
+        if (alen == 0) {
+            return true;
+        }
+        const auto &x = *(a + (alen - 1));
+        const auto &y = *(b + (blen - 1));
+        if (comp(x, y)) {
+            return lessPrefix(a, alen - 1, b, blen, comp);
+        }
+        if (comp(y, x)) { // u <= v'
+            return lessPrefix(a, alen, b, blen - 1, comp) || (alen == blen - 1 && equalPrefix(a, b, alen, comp));
+        }
+        return lessPrefix(a, alen - 1, b, blen - 1, comp);
+    }
+
+    template<typename iteratortype, typename symbolless>
+    static bool equalPrefix(iteratortype a, iteratortype b, std::size_t len, const symbolless &comp) {
+        for (; len; --len, ++a, ++b) {
+            if (comp(*a, *b) || comp(*b, *a)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Prefers strings made of the preferred symbols: first the ones with fewer other symbols, then the ones with more
+// preferred symbols, then shortlex. Used to rewrite strings into as few different symbols as possible (see test3).
+template<typename symboltype>
+struct SymbolPreferenceOrdering {
+    struct keytype {
+        uint32_t others;
+        uint32_t preferred;
+        std::size_t length;
+    };
+
+    std::vector <symboltype> preferred; // sorted
+
+    SymbolPreferenceOrdering() = default;
+
+    template<typename containertype>
+    explicit SymbolPreferenceOrdering(const containertype &preferred_) :
+            preferred(preferred_.begin(), preferred_.end()) {
+        std::sort(preferred.begin(), preferred.end());
+    }
+
+    template<typename stringtype>
+    keytype key(const stringtype &s) const {
+        keytype ret{0, 0, s.size()};
+        for (const auto &c : s) {
+            if (std::binary_search(preferred.begin(), preferred.end(), c)) {
+                ++ret.preferred;
+            } else {
+                ++ret.others;
+            }
+        }
+        return ret;
+    }
+
+    int compareKeys(const keytype &a, const keytype &b) const {
+        if (a.others != b.others) {
+            return a.others < b.others ? -1 : 1;
+        }
+        if (a.preferred != b.preferred) {
+            return a.preferred > b.preferred ? -1 : 1;
+        }
+        if (a.length != b.length) {
+            return a.length < b.length ? -1 : 1;
+        }
+        return 0;
+    }
+
+    template<typename stringtype, typename symbolless>
+    bool less(const stringtype &a, const stringtype &b, const symbolless &comp) const {
+        return symbolsLess(a.begin(), a.end(), b.begin(), b.end(), comp);
+    }
+};
+
+// Any ordering given at run time, at the price of a std::function call per comparison and no keys.
+// The completion compares views on its strings, so viewtype is SymbolSpan<symboltype>.
+template<typename viewtype>
+struct DynamicOrdering {
+    typedef NoOrderingKey keytype;
+
+    std::function<bool(const viewtype &, const viewtype &)> comparison;
+
+    DynamicOrdering() = default;
+
+    explicit DynamicOrdering(const std::function<bool(const viewtype &, const viewtype &)> &comparison_) :
+            comparison(comparison_) {
+    }
+
+    template<typename stringtype>
+    keytype key(const stringtype &) const {
+        return keytype();
+    }
+
+    int compareKeys(const keytype &, const keytype &) const {
+        return 0;
+    }
+
+    template<typename symbolless>
+    bool less(const viewtype &a, const viewtype &b, const symbolless &) const {
+        return comparison(a, b);
+    }
+};
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef PACKED_SYMBOLS_HPP
+#define PACKED_SYMBOLS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Comparing strings of symbols that are integers of 1 or 2 bytes, compared with the default std::equal_to and std::less:
+// the first mismatch gets searched 32 (avx2) or 16 (sse2) bytes at a time, with a scalar loop for the tail and for
+// targets without either. Any other symbols, comparators or non-contiguous strings take the plain std algorithms.
+// DenseAlphabet maps an arbitrary alphabet onto such codes.
+
+// Index of the first byte where a and b differ, or n.
+inline std::size_t mismatchBytes(const unsigned char *a, const unsigned char *b, const std::size_t n) {
+    std::size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        const unsigned differ = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (differ) {
+            return i + __builtin_ctz(differ);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        const unsigned differ = ~(unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffffu;
+        if (differ) {
+            return i + __builtin_ctz(differ);
+        }
+    }
+#endif
+    while (i < n && a[i] == b[i]) {
+        ++i;
+    }
+    return i;
+}
+
+template<typename symboltype>
+std::size_t mismatchSymbols(const symboltype *a, const symboltype *b, const std::size_t n) {
+    const std::size_t bytes = mismatchBytes(reinterpret_cast<const unsigned char *>(a), reinterpret_cast<const unsigned char *>(b), n * sizeof(symboltype));
+    return bytes / sizeof(symboltype);
+}
+
+// basic_string only gets named for the character types the standard has char_traits for, libc++ refuses the others.
+template<typename iteratortype, typename valuetype,
+        bool character = std::is_same<valuetype, char>::value || std::is_same<valuetype, char16_t>::value>
+struct StringIterator {
+    static constexpr bool value = false;
+};
+
+template<typename iteratortype, typename valuetype>
+struct StringIterator<iteratortype, valuetype, true> {
+    static constexpr bool value = std::is_same<iteratortype, typename std::basic_string<valuetype>::iterator>::value
+                                  || std::is_same<iteratortype, typename std::basic_string<valuetype>::const_iterator>::value;
+};
+
+// True for pointers and for the iterators of vector and basic_string, over integers of at most 2 bytes.
+template<typename iteratortype, typename valuetype = typename std::iterator_traits<iteratortype>::value_type,
+        bool small = std::is_integral<valuetype>::value && sizeof(valuetype) <= 2 && !std::is_same<valuetype, bool>::value>
+struct PackedIterator {
+    static constexpr bool value = false;
+};
+
+template<typename iteratortype, typename valuetype>
+struct PackedIterator<iteratortype, valuetype, true> {
+    static constexpr bool value = std::is_pointer<iteratortype>::value
+                                  || std::is_same<iteratortype, typename std::vector<valuetype>::iterator>::value
+                                  || std::is_same<iteratortype, typename std::vector<valuetype>::const_iterator>::value
+                                  || StringIterator<iteratortype, valuetype>::value;
+};
+
+template<typename iteratortype1, typename iteratortype2, typename predicatetype, template<typename> class defaulttype>
+struct PackedComparison {
+    typedef typename std::iterator_traits<iteratortype1>::value_type valuetype;
+    static constexpr bool value = PackedIterator<iteratortype1>::value
+                                  && PackedIterator<iteratortype2>::value
+                                  && std::is_same<valuetype, typename std::iterator_traits<iteratortype2>::value_type>::value
+                                  && std::is_same<predicatetype, defaulttype<valuetype>>::value;
+};
+
+template<typename iteratortype>
+const typename std::iterator_traits<iteratortype>::value_type *packedData(const iteratortype &begin) {
+    return &*begin;
+}
+
+template<typename iteratortype1, typename iteratortype2, typename symbolequal>
+bool symbolsEqual(const iteratortype1 &begin1, const iteratortype1 &end1, const iteratortype2 &begin2, const iteratortype2 &end2,
+                  const symbolequal &eq, std::false_type) {
+    return std::equal(begin1, end1, begin2, end2, eq);
+}
+
+template<typename iteratortype1, typename iteratortype2, typename symbolequal>
+bool symbolsEqual(const iteratortype1 &begin1, const iteratortype1 &end1, const iteratortype2 &begin2, const iteratortype2 &end2,
+                  const symbolequal &, std::true_type) {
+    const std::size_t n = end1 - begin1;
+    if (n != (std::size_t) (end2 - begin2)) {
+        return false;
+    }
+    return n == 0 || mismatchSymbols(packedData(begin1), packedData(begin2), n) == n;
+}
+
+template<typename iteratortype1, typename iteratortype2, typename symbolequal>
+bool symbolsEqual(const iteratortype1 &begin1, const iteratortype1 &end1, const iteratortype2 &begin2, const iteratortype2 &end2,
+                  const symbolequal &eq) {
+    return symbolsEqual(begin1, end1, begin2, end2, eq,
+                        std::integral_constant<bool, PackedComparison<iteratortype1, iteratortype2, symbolequal, std::equal_to>::value>());
+}
+
+template<typename iteratortype1, typename iteratortype2, typename symbolless>
+bool symbolsLess(const iteratortype1 &begin1, const iteratortype1 &end1, const iteratortype2 &begin2, const iteratortype2 &end2,
+                 const symbolless &comp, std::false_type) {
+    return std::lexicographical_compare(begin1, end1, begin2, end2, comp);
+}
+
+template<typename iteratortype1, typename iteratortype2, typename symbolless>
+bool symbolsLess(const iteratortype1 &begin1, const iteratortype1 &end1, const iteratortype2 &begin2, const iteratortype2 &end2,
+                 const symbolless &comp, std::true_type) {
+    const std::size_t n1 = end1 - begin1;
+    const std::size_t n2 = end2 - begin2;
+    const std::size_t n = std::min(n1, n2);
+    const std::size_t m = n == 0 ? 0 : mismatchSymbols(packedData(begin1), packedData(begin2), n);
+    if (m < n) {
+        return comp(begin1[m], begin2[m]);
+    }
+    return n1 < n2;
+}
+
+// std::lexicographical_compare
+template<typename iteratortype1, typename iteratortype2, typename symbolless>
+bool symbolsLess(const iteratortype1 &begin1, const iteratortype1 &end1, const iteratortype2 &begin2, const iteratortype2 &end2,
+                 const symbolless &comp) {
+    return symbolsLess(begin1, end1, begin2, end2, comp,
+                       std::integral_constant<bool, PackedComparison<iteratortype1, iteratortype2, symbolless, std::less>::value>());
+}
+
+// Maps the symbols of any alphabet onto dense codes, in order of appearance. A completion over the codes (with a
+// symbolinfo like DenseAlphabet::symbolinfo) takes the packed comparisons above.
+template<typename sourcesymboltype, typename codetype = uint8_t>
+struct DenseAlphabet {
+    static_assert(std::is_integral<codetype>::value && sizeof(codetype) <= 2, "codes are meant to be packed");
+
+    struct symbolinfo {
+        typedef codetype symboltype;
+        typedef std::vector<codetype> stringtype;
+    };
+
+    std::map <sourcesymboltype, codetype> codes;
+    std::vector <sourcesymboltype> symbols; // indexed by code
+
+    // false when the alphabet doesn't fit in codetype anymore.
+    template<typename iteratortype>
+    bool encode(const iteratortype &begin, const iteratortype &end, std::vector <codetype> &ret) {
+        ret.clear();
+        for (auto i = begin; i != end; ++i) {
+            auto it = codes.find(*i);
+            if (it == codes.end()) {
+                if (symbols.size() > (std::size_t) std::numeric_limits<codetype>::max()) {
+                    return false;
+                }
+                it = codes.insert(std::make_pair(*i, (codetype) symbols.size())).first;
+                symbols.push_back(*i);
+            }
+            ret.push_back(it->second);
+        }
+        return true;
+    }
+
+    template<typename stringtype>
+    bool encode(const stringtype &s, std::vector <codetype> &ret) {
+        return encode(s.begin(), s.end(), ret);
+    }
+
+    template<typename stringtype, typename iteratortype>
+    stringtype decode(const iteratortype &begin, const iteratortype &end) const {
+        stringtype ret;
+        for (auto i = begin; i != end; ++i) {
+            ret.push_back(symbols[*i]);
+        }
+        return ret;
+    }
+
+    template<typename stringtype, typename codestringtype>
+    stringtype decode(const codestringtype &s) const {
+        return decode<stringtype>(s.begin(), s.end());
+    }
+};
+
+#endif
@@ -0,0 +1,366 @@
+#ifndef REWRITE_AUTOMATON_HPP
+#define REWRITE_AUTOMATON_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+// Aho-Corasick automaton over the left hand sides of the rules.
+// Apart from the usual "report all matches in a string" it exposes its states, which allows for rewriting a string
+// while keeping a stack of states: after a replacement the scan resumes from the state before the rewritten part
+// instead of starting all over again.
+// The failure links are recomputed lazily, on the first query after the trie changed.
+// Strings can be taken out again: erase() drops a payload right away, sweep() drops all payloads that became empty in
+// the meantime. Either way the branches that no longer lead to a payload get pruned, and once more than half of the
+// states are dead the automaton compacts itself, so matching only ever sees the strings that are still in it.
+// Next to matching it answers overlap queries for a string of the trie: which strings start with one of its suffixes,
+// and which strings contain it. Those follow the failure links, and the failure links the other way round.
+// The children of a state are ordered with symbolless, which should be the one the strings are stored with (see
+// StringStorage::comp). Two symbols neither of which is less than the other count as the same edge.
+template<typename symboltype, typename payloadtype, typename symbolless = std::less<symboltype>>
+struct RewriteAutomaton {
+    typedef std::size_t stateid;
+    static const stateid root = 0;
+    static const stateid npos = ~stateid(0);
+
+    struct Node {
+        std::vector <std::pair<symboltype, stateid>> children; // sorted on symbol
+        std::unique_ptr <payloadtype> payload; // only present on nodes at the end of an inserted string.
+        std::size_t depth = 0;
+        stateid fail = root; // longest proper suffix that is also a node in the trie.
+        stateid output = npos; // first node with a payload along the chain of failure links.
+        bool dead = false; // pruned, waiting for compact().
+    };
+
+    std::vector <Node> nodes; // a child always has a higher id than its parent.
+    bool links_dirty = false;
+    std::size_t dead_states = 0;
+
+    // The failure links reversed, by updateLinks(): the states whose failure link points to state s are
+    // fail_children[fail_children_begin[s]] up to fail_children[fail_children_begin[s + 1]].
+    std::vector <stateid> fail_children_begin;
+    std::vector <stateid> fail_children;
+
+    symbolless comp;
+
+    RewriteAutomaton(const symbolless &comp_ = symbolless()) :
+            nodes(1), comp(comp_) {
+    }
+
+    stateid child(const stateid s, const symboltype &c) const {
+        const auto &ch = nodes[s].children;
+        const auto it = std::lower_bound(ch.begin(), ch.end(), c, [&](const std::pair<symboltype, stateid> &a, const symboltype &b) {
+            return comp(a.first, b);
+        });
+        if (it == ch.end() || comp(c, it->first)) {
+            return npos;
+        }
+        return it->second;
+    }
+
+    template<typename iteratortype>
+    payloadtype &getOrCreate(const iteratortype &begin, const iteratortype &end) {
+        stateid s = root;
+        for (auto i = begin; i != end; ++i) {
+            stateid next = child(s, *i);
+            if (next == npos) {
+                next = nodes.size();
+                nodes.emplace_back();
+                nodes.back().depth = nodes[s].depth + 1;
+                auto &ch = nodes[s].children;
+                ch.insert(std::upper_bound(ch.begin(), ch.end(), *i, [&](const symboltype &a, const std::pair<symboltype, stateid> &b) {
+                    return comp(a, b.first);
+                }), std::make_pair(*i, next));
+                links_dirty = true;
+            }
+            s = next;
+        }
+        if (!nodes[s].payload) {
+            nodes[s].payload.reset(new payloadtype());
+            links_dirty = true; // the output links change.
+        }
+        return *nodes[s].payload;
+    }
+
+    template<typename stringtype>
+    payloadtype &getOrCreate(const stringtype &s) {
+        return getOrCreate(s.begin(), s.end());
+    }
+
+    template<typename stringtype>
+    payloadtype *getNoCreate(const stringtype &str) {
+        stateid s = root;
+        for (const auto &c : str) {
+            s = child(s, c);
+            if (s == npos) {
+                return nullptr;
+            }
+        }
+        return nodes[s].payload.get();
+    }
+
+    std::size_t liveStates() const {
+        return nodes.size() - dead_states;
+    }
+
+    // Removes the payload of the given string, if any, together with the part of its path that leads to nothing else.
+    template<typename iteratortype>
+    bool erase(const iteratortype &begin, const iteratortype &end) {
+        std::vector <stateid> path(1, root);
+        for (auto i = begin; i != end; ++i) {
+            const stateid next = child(path.back(), *i);
+            if (next == npos) {
+                return false;
+            }
+            path.push_back(next);
+        }
+        if (!nodes[path.back()].payload) {
+            return false;
+        }
+        nodes[path.back()].payload.reset();
+        links_dirty = true;
+        while (path.size() > 1 && !nodes[path.back()].payload && nodes[path.back()].children.empty()) {
+            const stateid s = path.back();
+            path.pop_back();
+            auto &ch = nodes[path.back()].children;
+            ch.erase(std::find_if(ch.begin(), ch.end(), [&](const std::pair<symboltype, stateid> &c) {
+                return c.second == s;
+            }));
+            kill(s);
+        }
+        compactIfSparse();
+        return true;
+    }
+
+    template<typename stringtype>
+    bool erase(const stringtype &s) {
+        return erase(s.begin(), s.end());
+    }
+
+    // Drops the payloads that are empty() and prunes what leads to nothing else. Returns the amount of dropped payloads.
+    // Meant to be called between bulk updates, while payloads get emptied the matching simply skips them.
+    std::size_t sweep() {
+        std::size_t dropped = 0;
+        const std::size_t dead_before = dead_states;
+        for (stateid s = nodes.size(); s-- > 0;) { // children come after their parent, so they have been decided already.
+            Node &n = nodes[s];
+            if (n.dead) {
+                continue;
+            }
+            if (n.payload && n.payload->empty()) {
+                n.payload.reset();
+                ++dropped;
+            }
+            n.children.erase(std::remove_if(n.children.begin(), n.children.end(), [&](const std::pair<symboltype, stateid> &c) {
+                return nodes[c.second].dead;
+            }), n.children.end());
+            if (s != root && !n.payload && n.children.empty()) {
+                kill(s);
+            }
+        }
+        if (dropped || dead_states != dead_before) {
+            links_dirty = true;
+        }
+        compactIfSparse();
+        return dropped;
+    }
+
+    void kill(const stateid s) {
+        Node &n = nodes[s];
+        n.dead = true;
+        n.payload.reset();
+        std::vector<std::pair<symboltype, stateid>>().swap(n.children);
+        ++dead_states;
+    }
+
+    void compactIfSparse() {
+        if (dead_states * 2 > nodes.size()) {
+            compact();
+        }
+    }
+
+    // Renumbers the live states breadth first and drops the dead ones. This invalidates all state ids.
+    void compact() {
+        if (!dead_states) {
+            return;
+        }
+        std::vector <stateid> order(1, root);
+        std::vector <stateid> newid(nodes.size(), npos);
+        newid[root] = root;
+        for (std::size_t qi = 0; qi < order.size(); ++qi) {
+            for (const auto &c : nodes[order[qi]].children) {
+                newid[c.second] = order.size();
+                order.push_back(c.second);
+            }
+        }
+        std::vector <Node> compacted(order.size());
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            compacted[i] = std::move(nodes[order[i]]);
+            for (auto &c : compacted[i].children) {
+                c.second = newid[c.second];
+            }
+        }
+        nodes.swap(compacted);
+        dead_states = 0;
+        links_dirty = true;
+    }
+
+    // (re)computes the failure- and output links, breadth first.
+    void updateLinks() {
+        if (!links_dirty) {
+            return;
+        }
+        std::vector <stateid> queue(1, root);
+        nodes[root].fail = root;
+        nodes[root].output = npos;
+        for (std::size_t qi = 0; qi < queue.size(); ++qi) {
+            const stateid u = queue[qi];
+            for (const auto &c : nodes[u].children) {
+                const stateid v = c.second;
+                stateid f = npos;
+                if (u != root) {
+                    stateid w = nodes[u].fail;
+                    while (true) {
+                        f = child(w, c.first);
+                        if (f != npos || w == root) {
+                            break;
+                        }
+                        w = nodes[w].fail;
+                    }
+                }
+                nodes[v].fail = f == npos ? root : f;
+                const auto &fn = nodes[nodes[v].fail];
+                nodes[v].output = fn.payload ? nodes[v].fail : fn.output;
+                queue.push_back(v);
+            }
+        }
+        fail_children_begin.assign(nodes.size() + 1, 0);
+        for (std::size_t qi = 1; qi < queue.size(); ++qi) {
+            ++fail_children_begin[nodes[queue[qi]].fail + 1];
+        }
+        for (std::size_t s = 0; s < nodes.size(); ++s) {
+            fail_children_begin[s + 1] += fail_children_begin[s];
+        }
+        fail_children.resize(queue.size() - 1);
+        std::vector <stateid> filled(fail_children_begin.begin(), fail_children_begin.end() - 1);
+        for (std::size_t qi = 1; qi < queue.size(); ++qi) {
+            fail_children[filled[nodes[queue[qi]].fail]++] = queue[qi];
+        }
+        links_dirty = false;
+    }
+
+    // goto function, following failure links when the trie has no edge for c. updateLinks() must be up to date.
+    stateid step(stateid s, const symboltype &c) const {
+        while (true) {
+            const stateid next = child(s, c);
+            if (next != npos) {
+                return next;
+            }
+            if (s == root) {
+                return root;
+            }
+            s = nodes[s].fail;
+        }
+    }
+
+    // Calls fct(payload, depth) for every string in the trie that is a suffix of the path to state s, longest first.
+    // Stops as soon as fct returns false.
+    template<typename callbacktype>
+    bool iterate_outputs(stateid s, const callbacktype &fct) {
+        if (!nodes[s].payload) {
+            s = nodes[s].output;
+        }
+        while (s != npos) {
+            if (!fct(*nodes[s].payload, nodes[s].depth)) {
+                return false;
+            }
+            s = nodes[s].output;
+        }
+        return true;
+    }
+
+    // Calls fct(payload, depth) for every string in the trie that starts with the path to state s, s itself included
+    // when include_self is set.
+    template<typename callbacktype>
+    void iterate_extensions(const stateid s, const bool include_self, const callbacktype &fct) {
+        if (include_self && nodes[s].payload) {
+            fct(*nodes[s].payload, nodes[s].depth);
+        }
+        for (const auto &c : nodes[s].children) {
+            iterate_extensions(c.second, true, fct);
+        }
+    }
+
+    // Calls fct(payload, overlap) for every string in the trie that starts with a proper suffix of [begin, end) of
+    // length overlap and goes on past end, ie the strings that can be put behind it with an overlap.
+    template<typename iteratortype, typename callbacktype>
+    void iterate_suffix_overlaps(const iteratortype &begin, const iteratortype &end, const callbacktype &fct) {
+        updateLinks();
+        const std::size_t length = std::distance(begin, end);
+        stateid s = root;
+        for (auto i = begin; i != end; ++i) {
+            s = step(s, *i);
+        }
+        for (; s != root; s = nodes[s].fail) {
+            if (nodes[s].depth < length) {
+                iterate_extensions(s, false, [&](payloadtype &payload, const std::size_t) {
+                    fct(payload, nodes[s].depth);
+                });
+            }
+        }
+    }
+
+    // Calls fct(payload, offset) for every occurrence of [begin, end) in a string of the trie, with the position where it
+    // starts. [begin, end) has to be a path of the trie, which a string that was inserted is.
+    template<typename iteratortype, typename callbacktype>
+    void iterate_superstrings(const iteratortype &begin, const iteratortype &end, const callbacktype &fct) {
+        updateLinks();
+        const std::size_t length = std::distance(begin, end);
+        stateid s = root;
+        for (auto i = begin; i != end && s != npos; ++i) {
+            s = child(s, *i);
+        }
+        if (s == npos || s == root) {
+            return;
+        }
+        // the states of which [begin, end) is a suffix: s and everything below it in the tree of failure links.
+        std::vector <stateid> todo(1, s);
+        while (!todo.empty()) {
+            const stateid t = todo.back();
+            todo.pop_back();
+            iterate_extensions(t, true, [&](payloadtype &payload, const std::size_t) {
+                fct(payload, nodes[t].depth - length);
+            });
+            todo.insert(todo.end(), fail_children.begin() + fail_children_begin[t], fail_children.begin() + fail_children_begin[t + 1]);
+        }
+    }
+
+    // Reports all matches as fct(payload, posbegin, posend), ordered by end position and longest first.
+    // Stops as soon as fct returns false.
+    template<typename iteratortype, typename callbacktype>
+    void iterate_matches(const iteratortype &begin, const iteratortype &end, const callbacktype &fct) {
+        updateLinks();
+        stateid s = root;
+        for (auto i = begin; i != end;) {
+            s = step(s, *i);
+            ++i;
+            const auto posend = i;
+            if (!iterate_outputs(s, [&](payloadtype &payload, const std::size_t depth) {
+                return fct(payload, std::prev(posend, depth), posend);
+            })) {
+                return;
+            }
+        }
+    }
+};
+
+template<typename symboltype, typename payloadtype, typename symbolless>
+const typename RewriteAutomaton<symboltype, payloadtype, symbolless>::stateid RewriteAutomaton<symboltype, payloadtype, symbolless>::root;
+
+template<typename symboltype, typename payloadtype, typename symbolless>
+const typename RewriteAutomaton<symboltype, payloadtype, symbolless>::stateid RewriteAutomaton<symboltype, payloadtype, symbolless>::npos;
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef REWRITE_SYSTEM_SNAPSHOT_HPP
+#define REWRITE_SYSTEM_SNAPSHOT_HPP
+
+#include "compiled_rewrite_system.hpp"
+#include "section_file.hpp"
+
+// A completed rewrite system as a file: the compiled automaton, all strings of the storage (so the string ids stay
+// meaningful) and the rules and identities as pairs of string ids.
+// Loading maps the file and points the tables of a CompiledRewriteSystem straight into it, so a worker process can
+// answer queries without parsing anything or running the completion itself.
+template<typename symbolinfo>
+struct RewriteSystemSnapshot {
+    typedef typename symbolinfo::symboltype symboltype;
+    typedef typename symbolinfo::stringtype stringtype;
+    typedef CompiledRewriteSystem<symbolinfo> systemtype;
+
+    static constexpr const char *magic = "KBRWSYS";
+    static const uint32_t version = 1;
+
+    enum {
+        section_alphabet,
+        section_direct_codes,
+        section_transitions,
+        section_accepting,
+        section_matches,
+        section_pool,
+        section_string_offsets, // strings + 1 entries, string i runs from offset i to offset i + 1 in string_symbols.
+        section_string_symbols,
+        section_rules,
+        section_identities,
+        section_count
+    };
+
+    struct IdPair {
+        uint64_t first, second;
+    };
+
+    systemtype system;
+    SymbolSpan<uint64_t> string_offsets;
+    SymbolSpan<symboltype> string_symbols;
+    SymbolSpan<IdPair> rules;
+    SymbolSpan<IdPair> identities;
+
+    template<typename completiontype>
+    static bool write(const std::string &path, completiontype &kbc) {
+        const systemtype compiled(kbc);
+        std::vector <uint64_t> offsets(1, 0);
+        std::vector <symboltype> symbols;
+        for (const auto &s : kbc.ss->strings) {
+            symbols.insert(symbols.end(), s.begin(), s.end());
+            offsets.push_back(symbols.size());
+        }
+        std::vector <IdPair> rules;
+        for (const auto &r : kbc.current_rules) {
+            rules.push_back(IdPair{(uint64_t) r.first, (uint64_t) r.second});
+        }
+        std::vector <IdPair> identities;
+        for (const auto &i : kbc.current_identities) {
+            identities.push_back(IdPair{(uint64_t) i.first, (uint64_t) i.second});
+        }
+
+        SectionFileWriter w;
+        w.add(compiled.alphabet.begin(), compiled.alphabet.size());
+        w.add(compiled.direct_codes.begin(), compiled.direct_codes.size());
+        w.add(compiled.transitions.begin(), compiled.transitions.size());
+        w.add(compiled.accepting.begin(), compiled.accepting.size());
+        w.add(compiled.matches.begin(), compiled.matches.size());
+        w.add(compiled.pool.begin(), compiled.pool.size());
+        w.add(offsets);
+        w.add(symbols);
+        w.add(rules);
+        w.add(identities);
+        return w.write(path, magic, version, sizeof(symboltype));
+    }
+
+    // Everything gets read into a separate snapshot and only replaces this one once it checks out, so a file that
+    // can't be used leaves this one as it was.
+    bool load(const std::string &path) {
+        MappedSectionFile f;
+        if (!f.open(path, magic, version, sizeof(symboltype)) || f.sectionCount() != section_count) {
+            return false;
+        }
+        RewriteSystemSnapshot l;
+        systemtype &s = l.system;
+        bool ok = section(f, section_alphabet, s.alphabet)
+                  && section(f, section_direct_codes, s.direct_codes)
+                  && section(f, section_transitions, s.transitions)
+                  && section(f, section_accepting, s.accepting)
+                  && section(f, section_matches, s.matches)
+                  && section(f, section_pool, s.pool)
+                  && section(f, section_string_offsets, l.string_offsets)
+                  && section(f, section_string_symbols, l.string_symbols)
+                  && section(f, section_rules, l.rules)
+                  && section(f, section_identities, l.identities);
+        ok = ok && s.transitions.size() == s.accepting.size() * (s.alphabet.size() + 1)
+             && !s.accepting.empty()
+             && (s.direct_codes.empty() || s.direct_codes.size() == std::size_t(1) << (8 * sizeof(symboltype)))
+             && !l.string_offsets.empty()
+             && l.string_offsets[l.string_offsets.size() - 1] == l.string_symbols.size();
+        if (!ok || !validTables(s) || !l.validStrings()) {
+            return false;
+        }
+        s.backing = f.mapping;
+        *this = l;
+        return true;
+    }
+
+    // the tables get indexed without checks during reduce, so every state, match and pool range has to stay inside
+    // them. A match must not remove more symbols than its state lies deep, measured as the shortest path from the root.
+    static bool validTables(const systemtype &s) {
+        for (const auto c : s.direct_codes) {
+            if (c > s.alphabet.size()) {
+                return false;
+            }
+        }
+        const std::size_t statecount = s.accepting.size();
+        for (const auto t : s.transitions) {
+            if (t >= statecount) {
+                return false;
+            }
+        }
+        for (const auto &m : s.matches) {
+            if (m.lhs_length == 0 || m.rhs_offset > s.pool.size() || m.rhs_length > s.pool.size() - m.rhs_offset) {
+                return false;
+            }
+        }
+        const std::size_t width = s.alphabet.size() + 1;
+        std::vector <std::size_t> depth(statecount, ~std::size_t(0));
+        std::vector <std::size_t> queue(1, 0);
+        depth[0] = 0;
+        for (std::size_t i = 0; i < queue.size(); ++i) {
+            const std::size_t from = queue[i];
+            for (std::size_t c = 0; c < width; ++c) {
+                const std::size_t to = s.transitions[from * width + c];
+                if (depth[to] == ~std::size_t(0)) {
+                    depth[to] = depth[from] + 1;
+                    queue.push_back(to);
+                }
+            }
+        }
+        for (std::size_t i = 0; i < statecount; ++i) {
+            if (s.accepting[i] == systemtype::none) {
+                continue;
+            }
+            if (s.accepting[i] >= s.matches.size() || s.matches[s.accepting[i]].lhs_length > depth[i]) {
+                return false; // unreachable states have an infinite depth and pass, reduce never gets there.
+            }
+        }
+        return true;
+    }
+
+    bool validStrings() const {
+        if (string_offsets[0] != 0) {
+            return false;
+        }
+        for (std::size_t i = 1; i < string_offsets.size(); ++i) {
+            if (string_offsets[i] < string_offsets[i - 1]) {
+                return false;
+            }
+        }
+        for (const auto *pairs : {&rules, &identities}) {
+            for (const auto &p : *pairs) {
+                if (p.first >= stringCount() || p.second >= stringCount()) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    template<typename T>
+    static bool section(const MappedSectionFile &f, const std::size_t i, SymbolSpan<T> &ret) {
+        const T *begin;
+        std::size_t count;
+        if (!f.section(i, begin, count)) {
+            return false;
+        }
+        ret = SymbolSpan<T>(begin, begin + count);
+        return true;
+    }
+
+    std::size_t stringCount() const {
+        return string_offsets.empty() ? 0 : string_offsets.size() - 1;
+    }
+
+    SymbolSpan<symboltype> string(const std::size_t i) const {
+        return SymbolSpan<symboltype>(string_symbols.begin() + string_offsets[i], string_symbols.begin() + string_offsets[i + 1]);
+    }
+
+    template<typename iteratortype, typename callbacktype>
+    void reduce(const iteratortype &begin, const iteratortype &end, const callbacktype &fct) const {
+        system.reduce(begin, end, fct);
+    }
+
+    std::pair<stringtype, bool> reduceCopy(const stringtype &s) const {
+        return system.reduceCopy(s);
+    }
+};
+
+template<typename symbolinfo>
+constexpr const char *RewriteSystemSnapshot<symbolinfo>::magic;
+
+template<typename symbolinfo>
+const uint32_t RewriteSystemSnapshot<symbolinfo>::version;
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef SECTION_FILE_HPP
+#define SECTION_FILE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Files made of sections: a fixed header (magic, version, size of a symbol, amount of sections), the (offset, count)
+// of every section and then the sections themselves, each one aligned on 8 bytes.
+// Everything is little-endian. The arrays are written as they are in memory, so this only works on little-endian
+// machines, which is checked on both ends.
+struct SectionFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t symbol_size;
+    uint64_t section_count;
+};
+
+struct SectionFileEntry {
+    uint64_t offset; // in bytes, from the start of the file.
+    uint64_t count; // in elements.
+};
+
+inline bool littleEndianHost() {
+    const uint16_t x = 1;
+    return *reinterpret_cast<const uint8_t *>(&x) == 1;
+}
+
+struct SectionFileWriter {
+    std::vector <std::pair<const void *, std::size_t>> data; // start and size in bytes, per section.
+    std::vector <uint64_t> counts;
+
+    template<typename T>
+    void add(const T *begin, const std::size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value, "sections are written byte for byte");
+        data.emplace_back(begin, count * sizeof(T));
+        counts.push_back(count);
+    }
+
+    template<typename T>
+    void add(const std::vector <T> &v) {
+        add(v.data(), v.size());
+    }
+
+    static uint64_t aligned(const uint64_t offset) {
+        return (offset + 7) & ~uint64_t(7);
+    }
+
+    bool write(const std::string &path, const char *magic, const uint32_t version, const uint32_t symbol_size) const {
+        if (!littleEndianHost()) {
+            return false;
+        }
+        SectionFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, magic, std::min(std::strlen(magic), sizeof(header.magic)));
+        header.version = version;
+        header.symbol_size = symbol_size;
+        header.section_count = data.size();
+        std::vector <SectionFileEntry> entries(data.size());
+        uint64_t offset = aligned(sizeof(header) + entries.size() * sizeof(SectionFileEntry));
+        for (std::size_t i = 0; i < data.size(); ++i) {
+            entries[i].offset = offset;
+            entries[i].count = counts[i];
+            offset = aligned(offset + data[i].second);
+        }
+
+        std::FILE *f = std::fopen(path.c_str(), "wb");
+        if (!f) {
+            return false;
+        }
+        const char padding[8] = {0};
+        bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+        ok = ok && (entries.empty() || std::fwrite(entries.data(), sizeof(SectionFileEntry), entries.size(), f) == entries.size());
+        uint64_t written = sizeof(header) + entries.size() * sizeof(SectionFileEntry);
+        for (std::size_t i = 0; ok && i < data.size(); ++i) {
+            ok = std::fwrite(padding, 1, entries[i].offset - written, f) == entries[i].offset - written;
+            ok = ok && (data[i].second == 0 || std::fwrite(data[i].first, 1, data[i].second, f) == data[i].second);
+            written = entries[i].offset + data[i].second;
+        }
+        ok = std::fclose(f) == 0 && ok;
+        return ok;
+    }
+};
+
+// Read-only mapping of a section file. Opening only checks the header and that every section lies within the file,
+// the sections are used in place.
+struct MappedSectionFile {
+    std::shared_ptr<const void> mapping; // unmaps when the last user is gone.
+    const char *base = nullptr;
+    std::size_t size = 0;
+    const SectionFileHeader *header = nullptr;
+    const SectionFileEntry *entries = nullptr;
+
+    bool open(const std::string &path, const char *magic, const uint32_t version, const uint32_t symbol_size) {
+        if (!littleEndianHost()) {
+            return false;
+        }
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        void *m = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(SectionFileHeader)) {
+            m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd); // the mapping stays valid.
+        if (m == MAP_FAILED) {
+            return false;
+        }
+        const std::size_t len = st.st_size;
+        mapping = std::shared_ptr<const void>(m, [len](const void *p) { munmap(const_cast<void *>(p), len); });
+        base = static_cast<const char *>(m);
+        size = len;
+        header = reinterpret_cast<const SectionFileHeader *>(base);
+        entries = reinterpret_cast<const SectionFileEntry *>(base + sizeof(SectionFileHeader));
+        if (std::strncmp(header->magic, magic, sizeof(header->magic)) != 0
+            || header->version != version
+            || header->symbol_size != symbol_size
+            || header->section_count > (size - sizeof(SectionFileHeader)) / sizeof(SectionFileEntry)) {
+            mapping.reset();
+            base = nullptr;
+            size = 0;
+            header = nullptr;
+            entries = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    std::size_t sectionCount() const {
+        return header ? header->section_count : 0;
+    }
+
+    // false when section i is missing, misaligned or runs past the end of the file.
+    template<typename T>
+    bool section(const std::size_t i, const T *&begin, std::size_t &count) const {
+        if (i >= sectionCount()) {
+            return false;
+        }
+        const SectionFileEntry &e = entries[i];
+        if (e.offset % alignof(T) != 0 || e.offset > size || e.count > (size - e.offset) / sizeof(T)) {
+            return false;
+        }
+        begin = reinterpret_cast<const T *>(base + e.offset);
+        count = e.count;
+        return true;
+    }
+};
+
+#endif
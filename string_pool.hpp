@@ -0,0 +1,236 @@
+#ifndef STRING_POOL_HPP
+#define STRING_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+// Non-owning view on a run of contiguous symbols, or any other elements. (std::span is not available before c++20.)
+template<typename symboltype>
+struct SymbolSpan {
+    const symboltype *first = nullptr;
+    const symboltype *last = nullptr;
+
+    SymbolSpan() = default;
+
+    SymbolSpan(const symboltype *first_, const symboltype *last_) :
+            first(first_), last(last_) {
+    }
+
+    const symboltype *begin() const { return first; }
+
+    const symboltype *end() const { return last; }
+
+    std::reverse_iterator<const symboltype *> rbegin() const { return std::reverse_iterator<const symboltype *>(last); }
+
+    std::reverse_iterator<const symboltype *> rend() const { return std::reverse_iterator<const symboltype *>(first); }
+
+    std::size_t size() const { return last - first; }
+
+    bool empty() const { return first == last; }
+
+    const symboltype &operator[](const std::size_t i) const { return first[i]; }
+};
+
+// A vector whose elements never move. Element i lives in segment k = log2(i / first_segment + 1), which holds
+// first_segment << k elements. One thread at a time may push_back while any other thread reads the first size() elements:
+// size() only counts an element once it has been written.
+template<typename T>
+class SegmentedVector {
+    static const std::size_t first_segment = 64;
+    static const unsigned max_segments = 48;
+
+    std::unique_ptr<T[]> segments[max_segments];
+    std::atomic <std::size_t> count{0};
+
+    static std::size_t segmentSize(const unsigned k) {
+        return first_segment << k;
+    }
+
+    static unsigned segmentOf(const std::size_t i, std::size_t &offset) {
+        const unsigned k = 63 - __builtin_clzll(i / first_segment + 1);
+        offset = i - first_segment * ((std::size_t(1) << k) - 1);
+        return k;
+    }
+
+public:
+    SegmentedVector() = default;
+
+    SegmentedVector(SegmentedVector &&o) noexcept {
+        *this = std::move(o);
+    }
+
+    SegmentedVector &operator=(SegmentedVector &&o) noexcept {
+        for (unsigned k = 0; k < max_segments; ++k) {
+            segments[k] = std::move(o.segments[k]);
+        }
+        count.store(o.count.load());
+        o.count.store(0);
+        return *this;
+    }
+
+    void push_back(T value) {
+        const std::size_t i = count.load(std::memory_order_relaxed);
+        std::size_t offset;
+        const unsigned k = segmentOf(i, offset);
+        assert(k < max_segments);
+        if (!segments[k]) {
+            segments[k].reset(new T[segmentSize(k)]);
+        }
+        segments[k][offset] = std::move(value);
+        count.store(i + 1, std::memory_order_release);
+    }
+
+    const T &operator[](const std::size_t i) const {
+        std::size_t offset;
+        const unsigned k = segmentOf(i, offset);
+        return segments[k][offset];
+    }
+
+    T &back() {
+        return (*this)[size() - 1];
+    }
+
+    T &operator[](const std::size_t i) {
+        std::size_t offset;
+        const unsigned k = segmentOf(i, offset);
+        return segments[k][offset];
+    }
+
+    std::size_t size() const { return count.load(std::memory_order_acquire); }
+
+    bool empty() const { return size() == 0; }
+
+    // in elements, for memory estimates.
+    std::size_t capacity() const {
+        std::size_t ret = 0;
+        for (unsigned k = 0; k < max_segments && segments[k]; ++k) {
+            ret += segmentSize(k);
+        }
+        return ret;
+    }
+};
+
+template<typename T>
+const std::size_t SegmentedVector<T>::first_segment;
+
+template<typename T>
+const unsigned SegmentedVector<T>::max_segments;
+
+// Append-only storage for strings of symbols. The symbols go back to back into large slabs and a string is known by its
+// index, which maps to (slab, offset, length). Slabs never move or shrink, so a view handed out stays valid for as
+// long as the pool lives, also while other strings get appended. The bookkeeping doesn't move either, so one thread at
+// a time may append while others read the strings that were there already (see StringStorage::makeConcurrent()).
+template<typename symboltype>
+class StringPool {
+    struct Entry {
+        uint32_t slab;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Slab {
+        std::unique_ptr<symboltype[]> symbols;
+        std::size_t capacity = 0;
+    };
+
+    static const std::size_t first_slab = 1024; // symbols, doubling up to max_slab.
+    static const std::size_t max_slab = std::size_t(1) << 20;
+
+    SegmentedVector <Slab> slabs;
+    std::size_t used = 0; // in the last slab
+    SegmentedVector <Entry> entries;
+
+    symboltype *allocate(const std::size_t length) {
+        if (slabs.empty() || used + length > slabs.back().capacity) {
+            const std::size_t grown = slabs.empty() ? first_slab : std::min(max_slab, 2 * slabs.back().capacity);
+            const std::size_t capacity = std::max(grown, length);
+            slabs.push_back(Slab{std::unique_ptr<symboltype[]>(new symboltype[capacity]), capacity});
+            used = 0;
+        }
+        return slabs.back().symbols.get() + used;
+    }
+
+public:
+    typedef SymbolSpan<symboltype> value_type;
+
+    class const_iterator {
+        const StringPool *pool;
+        std::size_t i;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef SymbolSpan<symboltype> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type *pointer;
+        typedef value_type reference;
+
+        const_iterator(const StringPool *pool_, const std::size_t i_) :
+                pool(pool_), i(i_) {
+        }
+
+        value_type operator*() const { return (*pool)[i]; }
+
+        const_iterator &operator++() {
+            ++i;
+            return *this;
+        }
+
+        bool operator==(const const_iterator &o) const { return i == o.i; }
+
+        bool operator!=(const const_iterator &o) const { return i != o.i; }
+    };
+
+    // returns the index of the new string. The string is readable by others once the index is.
+    template<typename iteratortype>
+    std::size_t append(const iteratortype &begin, const iteratortype &end) {
+        const std::size_t length = std::distance(begin, end);
+        std::copy(begin, end, allocate(length));
+        entries.push_back(Entry{(uint32_t) (slabs.size() - 1), (uint32_t) used, (uint32_t) length});
+        used += length;
+        return entries.size() - 1;
+    }
+
+    SymbolSpan<symboltype> operator[](const std::size_t i) const {
+        const Entry &e = entries[i];
+        const symboltype *first = slabs[e.slab].symbols.get() + e.offset;
+        return SymbolSpan<symboltype>(first, first + e.length);
+    }
+
+    std::size_t size() const { return entries.size(); }
+
+    bool empty() const { return entries.empty(); }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+
+    const_iterator end() const { return const_iterator(this, entries.size()); }
+
+    // all strings together, without the slack at the end of the slabs.
+    std::size_t symbolCount() const {
+        std::size_t ret = 0;
+        for (std::size_t i = 0, n = entries.size(); i < n; ++i) {
+            ret += entries[i].length;
+        }
+        return ret;
+    }
+
+    std::size_t memoryUsage() const {
+        std::size_t ret = entries.capacity() * sizeof(Entry) + slabs.capacity() * sizeof(Slab);
+        for (std::size_t i = 0, n = slabs.size(); i < n; ++i) {
+            ret += slabs[i].capacity * sizeof(symboltype);
+        }
+        return ret;
+    }
+};
+
+template<typename symboltype>
+const std::size_t StringPool<symboltype>::first_slab;
+
+template<typename symboltype>
+const std::size_t StringPool<symboltype>::max_slab;
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef SYMBOL_INVARIANTS_HPP
+#define SYMBOL_INVARIANTS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <type_traits>
+#include <vector>
+
+// Weighted symbol counts that every identity preserves, so every string it is equivalent to has the same ones: when
+// 2 strings differ in one of them, they can't have the same normal form, without reducing either.
+// An invariant is a weight per symbol and the value of a string is the sum of the weights of its symbols. They are the
+// solutions of count_lhs(s) - count_rhs(s) summed with the weights being 0 for every identity, and detect() finds a basis
+// of those. Symbols that appear in no identity only ever get counted together, as one more invariant.
+// A basis invariant with weights >= 0 (or made so by flipping the sign) also settles dominance: a substring can't weigh
+// more than the string, so when the second string weighs more, its normal form can't be a substring of the one of the
+// first.
+template<typename symboltype>
+struct SymbolInvariants {
+    static const std::size_t max_invariants = 64; // a summary never straddles a segment, see StringStorage::summary().
+
+    std::vector <symboltype> alphabet; // sorted, the symbols that appear in the identities.
+    std::vector <uint32_t> direct_codes; // as in CompiledRewriteSystem, for integral symbols of at most 2 bytes.
+    std::size_t count = 0; // invariants.
+    std::size_t stride = 1; // count rounded up to a power of 2, the size of a summary.
+    std::vector <int64_t> weights; // stride per symbol code, the code alphabet.size() stands for any other symbol.
+    std::vector <unsigned char> nonnegative; // per invariant.
+
+    static int64_t gcd(int64_t a, int64_t b) {
+        a = std::llabs(a);
+        b = std::llabs(b);
+        while (b) {
+            const int64_t t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+    static void divideByGcd(std::vector <int64_t> &v) {
+        int64_t g = 0;
+        for (const auto x : v) {
+            g = gcd(g, x);
+        }
+        if (g > 1) {
+            for (auto &x : v) {
+                x /= g;
+            }
+        }
+    }
+
+    typedef std::integral_constant<bool, std::is_integral<symboltype>::value && sizeof(symboltype) <= 2> directtype;
+
+    static std::size_t directIndex(const symboltype &s) {
+        return (std::size_t) s & ((std::size_t(1) << (8 * sizeof(symboltype))) - 1);
+    }
+
+    uint32_t code(const symboltype &s, std::true_type) const {
+        return direct_codes[directIndex(s)];
+    }
+
+    // any other symbol gets looked up in the sorted alphabet.
+    uint32_t code(const symboltype &s, std::false_type) const {
+        const auto it = std::lower_bound(alphabet.begin(), alphabet.end(), s);
+        if (it == alphabet.end() || s < *it) {
+            return alphabet.size();
+        }
+        return it - alphabet.begin();
+    }
+
+    uint32_t code(const symboltype &s) const {
+        return code(s, directtype());
+    }
+
+    void assignDirectCodes(std::true_type) {
+        direct_codes.assign(std::size_t(1) << (8 * sizeof(symboltype)), alphabet.size());
+        for (std::size_t c = 0; c < alphabet.size(); ++c) {
+            direct_codes[directIndex(alphabet[c])] = c;
+        }
+    }
+
+    void assignDirectCodes(std::false_type) {
+    }
+
+    // identities: pairs of strings of symbols.
+    template<typename identitiestype>
+    static SymbolInvariants detect(const identitiestype &identities) {
+        SymbolInvariants ret;
+        auto &alphabet = ret.alphabet;
+        for (const auto &e : identities) {
+            alphabet.insert(alphabet.end(), e.first.begin(), e.first.end());
+            alphabet.insert(alphabet.end(), e.second.begin(), e.second.end());
+        }
+        std::sort(alphabet.begin(), alphabet.end());
+        alphabet.erase(std::unique(alphabet.begin(), alphabet.end()), alphabet.end());
+        ret.assignDirectCodes(directtype());
+        const std::size_t n = alphabet.size();
+
+        // gauss-jordan elimination over the integers, on the difference in counts per identity.
+        std::vector <std::vector<int64_t>> rows;
+        for (const auto &e : identities) {
+            std::vector <int64_t> row(n, 0);
+            for (const auto &s : e.first) {
+                ++row[ret.code(s)];
+            }
+            for (const auto &s : e.second) {
+                --row[ret.code(s)];
+            }
+            if (std::any_of(row.begin(), row.end(), [](const int64_t x) { return x != 0; })) {
+                rows.push_back(row);
+            }
+        }
+        std::vector <std::size_t> pivots; // per row up to rank, its pivot column.
+        std::vector<bool> is_pivot(n, false);
+        for (std::size_t col = 0; col < n && pivots.size() < rows.size(); ++col) {
+            const std::size_t r = pivots.size();
+            std::size_t found = r;
+            while (found < rows.size() && rows[found][col] == 0) {
+                ++found;
+            }
+            if (found == rows.size()) {
+                continue;
+            }
+            std::swap(rows[r], rows[found]);
+            for (std::size_t j = 0; j < rows.size(); ++j) {
+                if (j == r || rows[j][col] == 0) {
+                    continue;
+                }
+                const int64_t a = rows[r][col];
+                const int64_t b = rows[j][col];
+                for (std::size_t c = 0; c < n; ++c) {
+                    rows[j][c] = rows[j][c] * a - rows[r][c] * b;
+                }
+                divideByGcd(rows[j]);
+            }
+            pivots.push_back(col);
+            is_pivot[col] = true;
+        }
+
+        // one solution per free column: 1 there (scaled to stay integral), 0 in the other free ones.
+        std::vector <std::vector<int64_t>> basis;
+        for (std::size_t f = 0; f < n && basis.size() + 1 < max_invariants; ++f) {
+            if (is_pivot[f]) {
+                continue;
+            }
+            int64_t scale = 1;
+            for (std::size_t r = 0; r < pivots.size(); ++r) {
+                if (rows[r][f] != 0) {
+                    const int64_t p = std::llabs(rows[r][pivots[r]]);
+                    scale = scale / gcd(scale, p) * p;
+                }
+            }
+            std::vector <int64_t> v(n, 0);
+            v[f] = scale;
+            for (std::size_t r = 0; r < pivots.size(); ++r) {
+                v[pivots[r]] = -rows[r][f] * (scale / rows[r][pivots[r]]);
+            }
+            divideByGcd(v);
+            if (std::all_of(v.begin(), v.end(), [](const int64_t x) { return x <= 0; })) {
+                for (auto &x : v) {
+                    x = -x;
+                }
+            }
+            basis.push_back(v);
+        }
+
+        ret.count = basis.size() + 1; // the last one counts the other symbols.
+        while (ret.stride < ret.count) {
+            ret.stride *= 2;
+        }
+        ret.weights.assign((n + 1) * ret.stride, 0);
+        ret.nonnegative.assign(ret.count, true);
+        for (std::size_t k = 0; k < basis.size(); ++k) {
+            for (std::size_t c = 0; c < n; ++c) {
+                ret.weights[c * ret.stride + k] = basis[k][c];
+                ret.nonnegative[k] = ret.nonnegative[k] && basis[k][c] >= 0;
+            }
+        }
+        ret.weights[n * ret.stride + basis.size()] = 1;
+        return ret;
+    }
+
+    // out gets stride values.
+    template<typename iteratortype>
+    void summarize(const iteratortype &begin, const iteratortype &end, int64_t *out) const {
+        std::fill(out, out + stride, 0);
+        for (auto i = begin; i != end; ++i) {
+            const int64_t *w = weights.data() + code(*i) * stride;
+            for (std::size_t k = 0; k < stride; ++k) {
+                out[k] += w[k];
+            }
+        }
+    }
+
+    // Strings with these summaries are not equivalent.
+    bool distinct(const int64_t *a, const int64_t *b) const {
+        bool ret = false;
+        for (std::size_t k = 0; k < stride; ++k) {
+            ret |= a[k] != b[k];
+        }
+        return ret;
+    }
+
+    // The normal form of the string summarized by b can't be a substring of the one of a.
+    bool cannotContain(const int64_t *a, const int64_t *b) const {
+        bool ret = false;
+        for (std::size_t k = 0; k < count; ++k) {
+            ret |= nonnegative[k] && b[k] > a[k];
+        }
+        return ret;
+    }
+};
+
+template<typename symboltype>
+const std::size_t SymbolInvariants<symboltype>::max_invariants;
+
+#endif
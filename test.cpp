@@ -1,6 +1,10 @@
 
-#include "knuth_bendix.hpp"
+#include "multi_ordering_completion.hpp"
+#include "rewrite_system_snapshot.hpp"
+#include "live_rewrite_system.hpp"
+#include "dominance_catalog.hpp"
 #include <iostream>
+#include <sstream>
 
 #define prt(x) std::cerr << #x " = '" << x << "'" << std::endl;
 #define prt2(x, y) std::cerr << #x " = '" << x << "'\t" << #y " = '" << y << "'" << std::endl;
@@ -88,83 +92,407 @@ void test1() {
 
 }
 
-void test3() {
-    // Attempt to build multiple rewrite systems each with a different complexity ordering.
-    // The intent is to minimise the amount of different symbols used.
-    // When 2 arbitrary strings can be reformulated such that one becomes a substring of the other, then we know that they are not equivalent.
-    //    And if we assume that all the symbols map to positive values then we can also conclude that the larger string is "more".
+struct vectorinfo {
+    typedef char symboltype;
+    typedef std::vector<symboltype> stringtype;
+};
+
+struct stringinfo {
+    typedef char symboltype;
+    typedef std::string stringtype;
+};
+
+// The presentation of test1, without its last identity when all is false.
+template<typename completiontype>
+void addTest1Identities(completiontype &kbc, const bool all = true) {
+    kbc.addIdentity({'1', 'x'}, {'x'});
+    kbc.addIdentity({'1', 'y'}, {'y'});
+    kbc.addIdentity({'x', '1'}, {'x'});
+    kbc.addIdentity({'y', '1'}, {'y'});
+    kbc.addIdentity({'x', 'x', 'x'}, {'1'});
+    kbc.addIdentity({'y', 'y', 'y'}, {'1'});
+    if (all) {
+        kbc.addIdentity({'x', 'y', 'x', 'y', 'x', 'y'}, {'1'});
+    }
+}
+
+template<typename completiontype>
+bool completeTest1(completiontype &kbc) {
+    addTest1Identities(kbc);
+    return kbc.run();
+}
+
+// The rules of a completion as strings, to compare completions on different storages.
+template<typename completiontype>
+std::set<std::pair<std::string, std::string>> ruleStrings(const completiontype &kbc) {
+    std::set<std::pair<std::string, std::string>> ret;
+    const auto &strings = kbc.ss->strings;
+    for (const auto &r : kbc.current_rules) {
+        ret.emplace(std::string(strings[r.first].begin(), strings[r.first].end()), std::string(strings[r.second].begin(), strings[r.second].end()));
+    }
+    return ret;
+}
 
+void testSelfOverlap() {
+    // a rule overlaps with itself: aba -> bab on abab gives babb == abbab. The positive braid monoid on 3 strands has no
+    // finite confluent system under shortlex, so no completion may claim to be done with aba -> bab alone.
     struct symbolinfo {
         typedef char symboltype;
         typedef std::basic_string<symboltype> stringtype;
     };
     StringStorage<symbolinfo, std::size_t> ss;
+    KnuthBendixCompletion<symbolinfo, std::size_t> kbc(&ss);
+    kbc.addIdentity("aba", "bab");
+    const bool completed = kbc.run(3);
+    assertss(!completed && kbc.current_rules.size() > 1, pt(completed) << pt(kbc.current_rules.size()));
+}
 
-    for (auto desired_symbols : std::vector<symbolinfo::stringtype>{"1", "2", "3", "4", "5", "9", "29", ""}) {
-        std::cerr << " ----------------------- " << std::endl
-                  << "desired symbols are " << toString(desired_symbols) << std::endl;
-        KnuthBendixCompletion<symbolinfo, std::size_t> kbc(&ss); // got to specify the complexity-comparator still.
-
-        auto countstuff = [&desired_symbols, &kbc](
-                const symbolinfo::stringtype &a,
-                int &goodcount,
-                int &badcount) {
-            for (char c : a) {
-                bool bad = true;
-                for (symbolinfo::symboltype desired : desired_symbols) {
-                    if (kbc.ss->eq(c, desired)) {
-                        bad = false;
-                        ++goodcount;
-                        break;
-                    }
-                }
-                if (bad) {
-                    ++badcount;
-                }
-            }
-        };
-        kbc.complexity_comparison = [&](const symbolinfo::stringtype &a,
-                                        const symbolinfo::stringtype &b) {
-            int bada = 0;
-            int gooda = 0;
-            countstuff(a, gooda, bada);
-            int badb = 0;
-            int goodb = 0;
-            countstuff(b, goodb, badb);
-            //prt4(a,b,bada,badb);
-            if (bada < badb) {
-                return true;
-            }
-            if (bada > badb) {
-                return false;
-            }
-            if (gooda > goodb) {
-                return true;
-            }
-            if (gooda < goodb) {
-                return false;
-            }
-            if (a.size() < b.size())
-                return true;
-            if (a.size() > b.size())
-                return false;
-            return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), kbc.ss->comp);
-        };
+void test2() {
+    // same presentation as test1, but completed with the incremental pair queue. Both systems must agree on normal forms.
+    struct symbolinfo {
+        typedef char symboltype;
+        typedef std::vector<symboltype> stringtype;
+    };
 
+    StringStorage<symbolinfo, std::size_t> ss;
+    KnuthBendixCompletion<symbolinfo, std::size_t> sweep(&ss);
+    KnuthBendixCompletion<symbolinfo, std::size_t> incremental(&ss);
+    incremental.incremental_deduction = true;
 
+    for (auto *kbc : {&sweep, &incremental}) {
+        completeTest1(*kbc);
+    }
 
-        //kbc.addIdentity("3","111");
-        kbc.addIdentity("12", "3");
-        kbc.addIdentity("12", "21");
-        //kbc.addIdentity("41","14");
-        kbc.addIdentity("5", "32");
-        kbc.addIdentity("4", "22");
-        // kbc.addIdentity("111","3");
-        //kbc.addIdentity("32","41");
-        kbc.addIdentity("2", "11");
-        kbc.addIdentity("54", "9");
-        kbc.addIdentity("8", "53");
-        kbc.run(5);
+    std::cerr << std::endl;
+    const auto &strings = incremental.ss->strings;
+    for (auto &i : incremental.current_rules) {
+        std::cerr << toString(strings[i.first]) << " --> " << toString(strings[i.second]) << std::endl;
+    }
+
+    for (auto &test : std::vector<std::string>{"xyyxxy", "yxyxyxxx", "1x1y1xyyy", "xxyyxxyy"}) {
+        const symbolinfo::stringtype word(test.begin(), test.end());
+        const auto a = sweep.reduceCopy(word).first;
+        const auto b = incremental.reduceCopy(word).first;
+        assertss(a == b, pt(test) << pt(toString(a)) << pt(toString(b)));
+    }
+}
+
+void testParallelDeduction() {
+    // the multithreaded deduction must produce exactly the same rules as test1.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    KnuthBendixCompletion<vectorinfo, std::size_t> parallel(&ss);
+    parallel.deduce_threads = 4;
+    completeTest1(plain);
+    completeTest1(parallel);
+    assertss(plain.current_rules == parallel.current_rules, pt(plain.current_rules.size()) << pt(parallel.current_rules.size()));
+}
+
+void testHashedIndex() {
+    // interning through the hashed index must end up with the same rules as through the ordered index.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    completeTest1(plain);
+    StringStorage<vectorinfo, std::size_t> hashed_ss;
+    hashed_ss.hashed_index = true;
+    KnuthBendixCompletion<vectorinfo, std::size_t> hashing(&hashed_ss);
+    completeTest1(hashing);
+    assertss(ruleStrings(plain) == ruleStrings(hashing), pt(plain.current_rules.size()) << pt(hashing.current_rules.size()));
+    // switching the hashed index off after interning through it must not hand out a second id for a known string.
+    StringStorage<stringinfo, std::size_t> switched;
+    switched.getOrCreateString(std::string("a"));
+    switched.hashed_index = true;
+    const std::size_t hashed = switched.getOrCreateString(std::string("c"));
+    switched.getOrCreateString(std::string("b"));
+    switched.hashed_index = false;
+    assertss(switched.getOrCreateString(std::string("c")) == hashed && switched.strings.size() == 3, pt(switched.strings.size()));
+    assertss(switched.getOrCreateString(std::string("d")) == 3 && switched.orderedStringIndexes() == (std::vector<std::size_t>{0, 2, 1, 3}), "");
+}
+
+void testStats() {
+    // collecting statistics must not change the outcome.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    completeTest1(plain);
+    KnuthBendixCompletion<vectorinfo, std::size_t, CompletionStats> measured(&ss);
+    std::size_t reported_cycles = 0;
+    measured.stats.on_cycle = [&](const CompletionStats::Cycle &) { ++reported_cycles; };
+    completeTest1(measured);
+    assertss(plain.current_rules == measured.current_rules, pt(measured.current_rules.size()));
+    const auto total = measured.stats.total();
+    assertss(reported_cycles == measured.cycle_count && total.rules == measured.current_rules.size(), pt(reported_cycles));
+    assertss(total.rules_added - total.rules_removed == total.rules && total.critical_pairs >= total.critical_pairs_discarded, pt(total.rules_added) << pt(total.rules_removed));
+}
+
+void testCheckpoint() {
+    // an interrupted completion, continued from its checkpoint, has to end up with the same rules.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    completeTest1(plain);
+    KnuthBendixCompletion<vectorinfo, std::size_t> interrupted(&ss);
+    interrupted.checkpoint_path = "test_knuth_bendix.checkpoint";
+    interrupted.checkpoint_every = 1;
+    addTest1Identities(interrupted);
+    interrupted.run(2);
+    KnuthBendixCompletion<vectorinfo, std::size_t> resumed(&ss);
+    assertss(resumed.loadCheckpoint("test_knuth_bendix.checkpoint"), "");
+    std::remove("test_knuth_bendix.checkpoint");
+    assertss(resumed.cycle_count == 2 && resumed.current_rules == interrupted.current_rules, pt(resumed.cycle_count));
+    resumed.run();
+    assertss(plain.current_rules == resumed.current_rules, pt(plain.current_rules.size()) << pt(resumed.current_rules.size()));
+}
+
+void testOrderings() {
+    // the other orderings: unit weights and the same comparison at run time must give the shortlex rules again.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    completeTest1(plain);
+    typedef WeightedShortLexOrdering<vectorinfo::symboltype> weightedtype;
+    typedef DynamicOrdering<SymbolSpan<vectorinfo::symboltype>> dynamictype;
+    KnuthBendixCompletion<vectorinfo, std::size_t, NoCompletionStats, weightedtype> weighted(&ss, weightedtype({{'x', 1}, {'y', 1}}));
+    KnuthBendixCompletion<vectorinfo, std::size_t, NoCompletionStats, dynamictype> dynamic(&ss, dynamictype([](const SymbolSpan<char> &a, const SymbolSpan<char> &b) {
+        return a.size() != b.size() ? a.size() < b.size() : std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+    }));
+    KnuthBendixCompletion<vectorinfo, std::size_t, NoCompletionStats, RecursivePathOrdering> recursive(&ss);
+    assertss(recursive.complexityLess(ss.getOrCreateString(std::string("xxx")), ss.getOrCreateString(std::string("y"))), "");
+    assertss(recursive.complexityLess(ss.getOrCreateString(std::string("yx")), ss.getOrCreateString(std::string("xy"))), "");
+    assertss(!recursive.complexityLess(ss.getOrCreateString(std::string("y")), ss.getOrCreateString(std::string("y"))), "");
+    completeTest1(weighted);
+    completeTest1(dynamic);
+    assertss(plain.current_rules == weighted.current_rules && plain.current_rules == dynamic.current_rules, pt(weighted.current_rules.size()) << pt(dynamic.current_rules.size()));
+    assertss(completeTest1(recursive), pt(recursive.current_rules.size()));
+    // another ordering gives other normal forms, but the same words are equivalent.
+    for (auto &test : std::vector<std::string>{"xyyxxy", "yxyxyxxx", "1x1y1xyyy", "xxyyxxyy"}) {
+        const vectorinfo::stringtype word(test.begin(), test.end());
+        for (auto &other : std::vector<std::string>{"1", "xy", "yyxx", "xyyx"}) {
+            const vectorinfo::stringtype otherword(other.begin(), other.end());
+            const bool shortlexequal = plain.reduceCopy(word).first == plain.reduceCopy(otherword).first;
+            const bool recursiveequal = recursive.reduceCopy(word).first == recursive.reduceCopy(otherword).first;
+            assertss(shortlexequal == recursiveequal, pt(test) << pt(other));
+        }
+    }
+}
+
+void testLimits() {
+    // the limits only postpone work: once the active set saturates the postponed pairs come back, the rules end up the
+    // same. A rule limit leaves identities over.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    completeTest1(plain);
+    KnuthBendixCompletion<vectorinfo, std::size_t> bounded(&ss);
+    bounded.max_identity_length = 4;
+    bounded.max_active_identities = 3;
+    assertss(completeTest1(bounded) && bounded.confluent() && plain.current_rules == bounded.current_rules, pt(bounded.current_rules.size()));
+    KnuthBendixCompletion<vectorinfo, std::size_t> capped(&ss);
+    capped.max_rules = 4;
+    assertss(completeTest1(capped) && !capped.confluent() && capped.current_rules.size() <= 4, pt(capped.current_rules.size()));
+}
+
+void testOverlapIndex() {
+    // the overlap index finds the same overlaps as trying every offset of every pair, so the rules are the same. Trying
+    // every offset of a rule on itself finds the trivial overlap and every other one twice, from either side.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    completeTest1(plain);
+    KnuthBendixCompletion<vectorinfo, std::size_t> indexed(&ss);
+    indexed.overlap_index = true;
+    assertss(completeTest1(indexed) && plain.current_rules == indexed.current_rules, pt(indexed.current_rules.size()));
+    std::size_t bruteforce = 0;
+    for (auto i = indexed.current_rules.begin(); i != indexed.current_rules.end(); ++i) {
+        std::size_t self = 0;
+        indexed.criticalPairs(*i, *i, [&](const vectorinfo::stringtype &, const auto &) { ++self; });
+        bruteforce += (self - 1) / 2;
+        for (auto j = std::next(i); j != indexed.current_rules.end(); ++j) {
+            indexed.criticalPairs(*i, *j, [&](const vectorinfo::stringtype &, const auto &) { ++bruteforce; });
+        }
+    }
+    assertss(indexed.indexedOverlaps().size() == bruteforce, pt(indexed.indexedOverlaps().size()) << pt(bruteforce));
+    // a completion with the index that gets the last relation later keeps using the index.
+    KnuthBendixCompletion<vectorinfo, std::size_t> growing(&ss);
+    growing.overlap_index = true;
+    addTest1Identities(growing, false);
+    assertss(growing.run(), pt(growing.current_rules.size()));
+    growing.ingestIdentity({'x', 'y', 'x', 'y', 'x', 'y'}, {'1'});
+    assertss(growing.update() && !growing.incremental_deduction && plain.current_rules == growing.current_rules, pt(growing.current_rules.size()));
+}
+
+void testNormalFormCache() {
+    // a tiny normal form cache keeps evicting but gives the same rules. Once the rules are final a word is reduced once,
+    // asking again is a hit.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    completeTest1(plain);
+    KnuthBendixCompletion<vectorinfo, std::size_t> cached(&ss);
+    cached.normal_forms.capacity = 3;
+    assertss(completeTest1(cached) && plain.current_rules == cached.current_rules && cached.normal_forms.size() <= 3, pt(cached.normal_forms.size()));
+    const std::string hot("yxyxyxxx");
+    const auto hits = cached.normal_forms.hits;
+    const auto first = cached.normalForm(hot.begin(), hot.end());
+    const auto expected_form = plain.reduceCopy(hot.begin(), hot.end()).first;
+    assertss(vectorinfo::stringtype(first.begin(), first.end()) == expected_form, pt(toString(expected_form)));
+    assertss(cached.normalForm(hot.begin(), hot.end()).begin() == first.begin() && cached.normal_forms.hits == hits + 1, pt(cached.normal_forms.hits));
+}
+
+void testLiveSystem() {
+    // the last relation arriving after completing the others: the old snapshot answers until the commit, after it the
+    // rules are those of completing everything at once.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    completeTest1(plain);
+    KnuthBendixCompletion<vectorinfo, std::size_t> growing(&ss);
+    addTest1Identities(growing, false);
+    assertss(growing.run() && growing.confluent(), pt(growing.current_rules.size()));
+    LiveRewriteSystem<vectorinfo, std::size_t> live(growing);
+    const vectorinfo::stringtype relation{'x', 'y', 'x', 'y', 'x', 'y'};
+    const auto before = live.snapshot();
+    live.ingest(relation, {'1'});
+    live.ingest({'x', 'x', 'x', 'x'}, {'x'}); // follows from the rules.
+    assertss(live.reduceCopy(relation).first == relation && live.pendingCount() == 2, "");
+    assertss(live.commit() && plain.current_rules == growing.current_rules, pt(growing.current_rules.size()));
+    assertss(live.reduceCopy(relation).first == plain.reduceCopy(relation).first && before->reduceCopy(relation).first == relation, "");
+    assertss(!growing.ingestIdentity({'y', 'x', 'y', 'x'}, {'x', 'x', 'y', 'y'}) && live.commit(), "");
+}
+
+void testFixpoint() {
+    // stopping at the first cycle that changes nothing gives the same rules, without keeping any history.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    completeTest1(plain);
+    KnuthBendixCompletion<vectorinfo, std::size_t> fixpoint(&ss);
+    fixpoint.fixpoint_detection_only = true;
+    assertss(completeTest1(fixpoint) && fixpoint.hashed_states.empty(), pt(fixpoint.cycle_count));
+    assertss(fixpoint.current_rules == plain.current_rules && fixpoint.cycle_count == plain.cycle_count, pt(fixpoint.cycle_count) << pt(plain.cycle_count));
+    fixpoint.recomputeFingerprint();
+    assertss(fixpoint.stateHash() == plain.stateHash(), "");
+}
+
+void testStringGarbage() {
+    // collecting the unused strings every cycle gives the same rules, and then only the strings in use remain.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    completeTest1(plain);
+    StringStorage<vectorinfo, std::size_t> collected_ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> collected(&collected_ss);
+    collected.collect_strings_every = 1;
+    assertss(completeTest1(collected), pt(collected.cycle_count));
+    collected.collectStringGarbage(); // the last cycle didn't get collected.
+    std::set<std::pair<vectorinfo::stringtype, vectorinfo::stringtype>> expected, got;
+    std::set<std::size_t> used;
+    for (const auto &r : plain.current_rules) {
+        expected.emplace(vectorinfo::stringtype(ss.strings[r.first].begin(), ss.strings[r.first].end()),
+                         vectorinfo::stringtype(ss.strings[r.second].begin(), ss.strings[r.second].end()));
+    }
+    for (const auto &r : collected.current_rules) {
+        got.emplace(vectorinfo::stringtype(collected_ss.strings[r.first].begin(), collected_ss.strings[r.first].end()),
+                    vectorinfo::stringtype(collected_ss.strings[r.second].begin(), collected_ss.strings[r.second].end()));
+    }
+    for (const auto *pairs : {&collected.input_identities, &collected.current_identities, &collected.current_rules}) {
+        for (const auto &p : *pairs) {
+            used.insert(p.first);
+            used.insert(p.second);
+        }
+    }
+    assertss(expected == got && used.size() == collected_ss.strings.size(), pt(used.size()) << pt(collected_ss.strings.size()));
+    const std::string word("yxyxyxxx");
+    assertss(collected.reduceCopy(word.begin(), word.end()).first == plain.reduceCopy(word.begin(), word.end()).first, "");
+}
+
+void testAutomatonPruning() {
+    // the automaton only holds the prefixes of the current left hand sides, and nothing after erasing them all.
+    StringStorage<vectorinfo, std::size_t> ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&ss);
+    completeTest1(plain);
+    std::set<vectorinfo::stringtype> prefixes;
+    for (const auto &r : plain.current_rules) {
+        const auto &lhs = ss.strings[r.first];
+        for (std::size_t l = 0; l <= lhs.size(); ++l) {
+            prefixes.insert(vectorinfo::stringtype(lhs.begin(), lhs.begin() + l));
+        }
+    }
+    assertss(plain.actree.liveStates() == prefixes.size(), pt(plain.actree.liveStates()) << pt(prefixes.size()));
+    for (const auto &r : plain.current_rules) {
+        assertss(plain.actree.erase(ss.strings[r.first]), "");
+    }
+    assertss(plain.actree.nodes.size() == 1 && plain.actree.liveStates() == 1, pt(plain.actree.nodes.size()));
+}
+
+void testAutomatonSymbolOrder() {
+    // the automaton orders its edges like the storage orders the symbols, here the other way round. The rules are
+    // those of shortlex over the reversed alphabet, the same words are equivalent either way.
+    struct symbolinfo {
+        typedef char symboltype;
+        typedef std::vector<symboltype> stringtype;
+        typedef std::greater<symboltype> symbolless;
+    };
+    StringStorage<symbolinfo, std::size_t> ss;
+    KnuthBendixCompletion<symbolinfo, std::size_t> reversed(&ss);
+    assertss(completeTest1(reversed), pt(reversed.current_rules.size()));
+    for (const auto &n : reversed.actree.nodes) {
+        assertss(std::is_sorted(n.children.begin(), n.children.end(), [](const std::pair<char, std::size_t> &a, const std::pair<char, std::size_t> &b) {
+            return a.first > b.first;
+        }), "");
+    }
+    StringStorage<vectorinfo, std::size_t> plain_ss;
+    KnuthBendixCompletion<vectorinfo, std::size_t> plain(&plain_ss);
+    completeTest1(plain);
+    const std::vector<std::string> words{"xyyxxy", "yxyxyxxx", "1x1y1xyyy", "xxyyxxyy", "1", "xy", "yyxx", "xyyx"};
+    for (const auto &a : words) {
+        for (const auto &b : words) {
+            const bool reversedequal = reversed.reduceCopy(a.begin(), a.end()).first == reversed.reduceCopy(b.begin(), b.end()).first;
+            const bool plainequal = plain.reduceCopy(a.begin(), a.end()).first == plain.reduceCopy(b.begin(), b.end()).first;
+            assertss(reversedequal == plainequal, pt(a) << pt(b));
+        }
+    }
+}
+
+const std::vector<std::string> test3_desired_symbols{"1", "2", "3", "4", "5", "9", "29", ""};
+const std::vector<std::string> test3_words{"123459", "493", "33331", "12229", "8888", "5999"};
+typedef KnuthBendixCompletion<stringinfo, std::size_t, NoCompletionStats, SymbolPreferenceOrdering<char>> test3completion;
+
+// The presentation of test3.
+template<typename completiontype>
+void addTest3Identities(completiontype &kbc) {
+    //kbc.addIdentity("3","111");
+    kbc.addIdentity("12", "3");
+    kbc.addIdentity("12", "21");
+    //kbc.addIdentity("41","14");
+    kbc.addIdentity("5", "32");
+    kbc.addIdentity("4", "22");
+    // kbc.addIdentity("111","3");
+    //kbc.addIdentity("32","41");
+    kbc.addIdentity("2", "11");
+    kbc.addIdentity("54", "9");
+    kbc.addIdentity("8", "53");
+}
+
+void completeTest3(test3completion &kbc) {
+    addTest3Identities(kbc);
+    kbc.run(5);
+}
+
+// Every word of test3 with the one after it.
+std::vector<std::pair<std::string, std::string>> test3Pairs() {
+    std::vector<std::pair<std::string, std::string>> ret;
+    for (std::size_t i = 0; i < test3_words.size(); ++i) {
+        ret.emplace_back(test3_words[i], test3_words[(i + 1) % test3_words.size()]);
+    }
+    return ret;
+}
+
+void test3() {
+    // Attempt to build multiple rewrite systems each with a different complexity ordering.
+    // The intent is to minimise the amount of different symbols used.
+    // When 2 arbitrary strings can be reformulated such that one becomes a substring of the other, then we know that they are not equivalent.
+    //    And if we assume that all the symbols map to positive values then we can also conclude that the larger string is "more".
+
+    StringStorage<stringinfo, std::size_t> ss;
+
+    for (auto desired_symbols : test3_desired_symbols) {
+        std::cerr << " ----------------------- " << std::endl
+                  << "desired symbols are " << toString(desired_symbols) << std::endl;
+        // fewer other symbols first, then more desired ones, then shortlex. The symbols get counted once per string.
+        test3completion kbc(&ss, SymbolPreferenceOrdering<char>(desired_symbols));
+        completeTest3(kbc);
 
 
         std::cerr << std::endl;
@@ -176,13 +504,337 @@ void test3() {
             std::cerr << toString(strings[i.first]) << " == " << toString(strings[i.second]) << std::endl;
         }
 
-        for (auto &test : std::vector<std::string>{"123459", "493", "33331", "12229", "8888", "5999"}) {
+        for (auto &test : test3_words) {
             std::cerr << "eg " << test << " reduces to " << toString(kbc.reduceCopy(test).first) << std::endl;
         }
     }
 }
 
+void testBatchQueries() {
+    // the batch api has to agree with reduceCopy, and with comparing the normal forms one by one.
+    StringStorage<stringinfo, std::size_t> ss;
+    const auto pairs = test3Pairs();
+    for (auto desired_symbols : test3_desired_symbols) {
+        test3completion kbc(&ss, SymbolPreferenceOrdering<char>(desired_symbols));
+        completeTest3(kbc);
+        const auto normalforms = kbc.normalForms(test3_words, 4);
+        for (std::size_t i = 0; i < test3_words.size(); ++i) {
+            assertss(normalforms[i] == kbc.reduceCopy(test3_words[i]).first, pt(test3_words[i]));
+        }
+        const auto verdicts = kbc.comparePairs(pairs, 4);
+        for (std::size_t i = 0; i < pairs.size(); ++i) {
+            const auto &a = normalforms[i];
+            const auto &b = normalforms[(i + 1) % test3_words.size()];
+            assertss(verdicts[i].equivalent == (a == b), pt(pairs[i].first) << pt(pairs[i].second));
+            assertss(verdicts[i].first_dominates == (a.find(b) != std::string::npos), pt(pairs[i].first) << pt(pairs[i].second));
+            assertss(verdicts[i].second_dominates == (b.find(a) != std::string::npos), pt(pairs[i].first) << pt(pairs[i].second));
+        }
+    }
+}
+
+void testCompiledSystem() {
+    // the compiled system has to agree with reduceCopy.
+    StringStorage<stringinfo, std::size_t> ss;
+    for (auto desired_symbols : test3_desired_symbols) {
+        test3completion kbc(&ss, SymbolPreferenceOrdering<char>(desired_symbols));
+        completeTest3(kbc);
+        const CompiledRewriteSystem<stringinfo> compiled(kbc);
+        for (const auto &test : test3_words) {
+            assertss(compiled.reduceCopy(test).first == kbc.reduceCopy(test).first, pt(test));
+        }
+    }
+}
+
+void testSnapshot() {
+    // a snapshot has the strings of the completion and has to agree with its reduceCopy, also after the file is gone.
+    StringStorage<stringinfo, std::size_t> ss;
+    for (auto desired_symbols : test3_desired_symbols) {
+        test3completion kbc(&ss, SymbolPreferenceOrdering<char>(desired_symbols));
+        completeTest3(kbc);
+        RewriteSystemSnapshot<stringinfo> snapshot;
+        assertss(RewriteSystemSnapshot<stringinfo>::write("test_knuth_bendix.snapshot", kbc), "");
+        assertss(snapshot.load("test_knuth_bendix.snapshot"), "");
+        {
+            // a transition out of the state table has to be refused on load, not followed during reduce. The snapshot
+            // that was loaded already stays as it was, the checks below still read it.
+            MappedSectionFile f;
+            const uint32_t *transitions;
+            std::size_t count;
+            assertss(f.open("test_knuth_bendix.snapshot", snapshot.magic, snapshot.version, sizeof(stringinfo::symboltype))
+                     && f.section(RewriteSystemSnapshot<stringinfo>::section_transitions, transitions, count) && count > 0, "");
+            const long offset = reinterpret_cast<const char *>(transitions) - f.base;
+            const uint32_t bad = ~uint32_t(0) - 1;
+            std::FILE *out = std::fopen("test_knuth_bendix.snapshot.bad", "wb");
+            std::fwrite(f.base, 1, offset, out);
+            std::fwrite(&bad, sizeof(bad), 1, out);
+            std::fwrite(f.base + offset + sizeof(bad), 1, f.size - offset - sizeof(bad), out);
+            std::fclose(out);
+            assertss(!snapshot.load("test_knuth_bendix.snapshot.bad"), "");
+            std::remove("test_knuth_bendix.snapshot.bad");
+        }
+        std::remove("test_knuth_bendix.snapshot"); // the mapping stays valid.
+        assertss(snapshot.stringCount() == ss.strings.size() && snapshot.rules.size() == kbc.current_rules.size(), pt(snapshot.stringCount()));
+        for (std::size_t i = 0; i < ss.strings.size(); ++i) {
+            const auto stored = snapshot.string(i);
+            assertss(std::equal(stored.begin(), stored.end(), ss.strings[i].begin(), ss.strings[i].end()), pt(i));
+        }
+        for (const auto &test : test3_words) {
+            assertss(snapshot.reduceCopy(test).first == kbc.reduceCopy(test).first, pt(test));
+        }
+    }
+}
+
+void testInvariants() {
+    // the identities preserve the value of the digits, which then tells "493" from "33331" and rules out one
+    // direction of dominance without reducing. The answers must stay the same.
+    StringStorage<stringinfo, std::size_t> ss;
+    const auto pairs = test3Pairs();
+    for (auto desired_symbols : test3_desired_symbols) {
+        test3completion kbc(&ss, SymbolPreferenceOrdering<char>(desired_symbols));
+        completeTest3(kbc);
+        const auto verdicts = kbc.comparePairs(pairs, 4);
+        kbc.detectInvariants();
+        const auto &invariants = *kbc.invariants;
+        assertss(invariants.count == 2 && invariants.nonnegative[0], pt(invariants.count));
+        for (const char digit : std::string("1234589")) {
+            assertss(invariants.weights[invariants.code(digit) * invariants.stride] == digit - '0', pt(digit));
+        }
+        const auto filtered = kbc.comparePairs(pairs, 4);
+        for (std::size_t i = 0; i < pairs.size(); ++i) {
+            const auto v = kbc.compare(ss.getOrCreateString(pairs[i].first), ss.getOrCreateString(pairs[i].second));
+            for (const auto &w : {v, filtered[i]}) {
+                assertss(w.equivalent == verdicts[i].equivalent && w.first_dominates == verdicts[i].first_dominates && w.second_dominates == verdicts[i].second_dominates,
+                         pt(pairs[i].first) << pt(pairs[i].second));
+            }
+        }
+        assertss(kbc.settled_by_invariants >= pairs.size(), pt(kbc.settled_by_invariants));
+        assertss(!kbc.equivalent(ss.getOrCreateString(std::string("493")), ss.getOrCreateString(std::string("33331"))), "");
+    }
+}
+
+void testDominanceCatalog() {
+    // the catalog has to find the same dominance as comparing the normal forms one by one.
+    StringStorage<stringinfo, std::size_t> ss;
+    for (auto desired_symbols : test3_desired_symbols) {
+        test3completion kbc(&ss, SymbolPreferenceOrdering<char>(desired_symbols));
+        completeTest3(kbc);
+        const CompiledRewriteSystem<stringinfo> compiled(kbc);
+        DominanceCatalog<stringinfo> catalog;
+        std::vector<std::string> entries(test3_words);
+        entries.insert(entries.end(), {"", "1", "2", "49", "9", "123459"});
+        for (auto &entry : entries) {
+            catalog.add(compiled, entry);
+        }
+        for (auto &query : std::vector<std::string>{"123459", "493", "33331", "8888", "3", "", "77"}) {
+            const auto n = kbc.reduceCopy(query).first;
+            std::set<std::size_t> dominated, dominating, expected_dominated, expected_dominating;
+            catalog.iterateDominatedBy(kbc, query, [&](const std::size_t e) { assertss(dominated.insert(e).second, pt(query) << pt(e)); });
+            catalog.iterateDominating(compiled, query, [&](const std::size_t e) { assertss(dominating.insert(e).second, pt(query) << pt(e)); });
+            for (std::size_t e = 0; e < entries.size(); ++e) {
+                if (n.find(catalog.normalForm(e)) != std::string::npos) {
+                    expected_dominated.insert(e);
+                }
+                if (catalog.normalForm(e).find(n) != std::string::npos) {
+                    expected_dominating.insert(e);
+                }
+            }
+            assertss(dominated == expected_dominated && dominating == expected_dominating, pt(query) << pt(dominated.size()) << pt(dominating.size()));
+        }
+    }
+}
+
+void testMultiOrdering() {
+    // all orderings at once, the confluent ones have to end up with the same rules as completing them one by one.
+    typedef MultiOrderingCompletion<stringinfo, std::size_t, SymbolPreferenceOrdering<char>> multicompletion;
+    multicompletion multi;
+    multi.threads = 4;
+    multi.maxcycles = 5;
+    addTest3Identities(multi);
+    for (const auto &desired_symbols : test3_desired_symbols) {
+        multi.addOrdering(SymbolPreferenceOrdering<char>(desired_symbols));
+    }
+    multi.run();
+    StringStorage<stringinfo, std::size_t> ss;
+    for (std::size_t i = 0; i < test3_desired_symbols.size(); ++i) {
+        test3completion single(&ss, SymbolPreferenceOrdering<char>(test3_desired_symbols[i]));
+        completeTest3(single);
+        assertss(!multi.results[i].confluent || ruleStrings(*multi.results[i].kbc) == ruleStrings(single), pt(test3_desired_symbols[i]));
+    }
+
+    // stop at the first ordering that rewrites 493 to a single kind of symbol, on 1 thread that is the first one.
+    multi.threads = 1;
+    multi.goal = [](multicompletion::completiontype &kbc) {
+        const auto nf = kbc.reduceCopy(std::string("493")).first;
+        return std::count(nf.begin(), nf.end(), nf[0]) == (long) nf.size();
+    };
+    assertss(multi.run() && multi.winner == 0, pt(multi.winner));
+    for (std::size_t i = 1; i < test3_desired_symbols.size(); ++i) {
+        assertss(!multi.results[i].kbc, pt(i));
+    }
+    // the winner outlives run() and can go on without the stop flag of the jobs.
+    auto &winner = *multi.results[0].kbc;
+    assertss(!winner.stop_requested && winner.run(), "");
+}
+
+void testPackedComparison() {
+    // the packed comparisons have to agree with the std algorithms, signed symbols and lengths past a vector included.
+    std::vector<std::string> words{"", "a", "ab", "b", "\x80", "\x7f"};
+    for (std::size_t n : {15, 16, 17, 31, 32, 33, 70}) {
+        const std::string w(n, 'x');
+        words.push_back(w);
+        for (std::size_t i : {std::size_t(0), n / 2, n - 1}) {
+            for (const char c : {'a', 'z', '\xf0'}) {
+                std::string v = w;
+                v[i] = c;
+                words.push_back(v);
+            }
+        }
+    }
+    for (const auto &a : words) {
+        for (const auto &b : words) {
+            const std::vector<char> va(a.begin(), a.end());
+            assertss(symbolsEqual(a.begin(), a.end(), b.begin(), b.end(), std::equal_to<char>()) == (a == b), pt(a) << pt(b));
+            assertss(symbolsEqual(va.begin(), va.end(), b.begin(), b.end(), std::equal_to<char>()) == (a == b), pt(a) << pt(b));
+            assertss(symbolsLess(a.begin(), a.end(), b.begin(), b.end(), std::less<char>()) == (std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end())), pt(a) << pt(b));
+        }
+    }
+}
+
+void testDenseAlphabet() {
+    // symbols of any type get dense codes in order of appearance, decoding gives the symbols back.
+    DenseAlphabet<std::string, uint16_t> alphabet;
+    const std::vector<std::string> sentence{"to", "be", "or", "not", "to", "be"};
+    std::vector<uint16_t> codes;
+    assertss(alphabet.encode(sentence, codes), "");
+    assertss(alphabet.symbols.size() == 4 && codes[0] == codes[4] && codes[1] == codes[5], pt(alphabet.symbols.size()));
+    assertss(alphabet.decode<std::vector<std::string>>(codes) == sentence, "");
+    // one symbol more than the codes can tell apart.
+    DenseAlphabet<int> bytes;
+    std::vector<int> wide;
+    for (int i = 0; i < 257; ++i) {
+        wide.push_back(i);
+    }
+    std::vector<uint8_t> narrow;
+    assertss(!bytes.encode(wide, narrow) && bytes.symbols.size() == 256, pt(bytes.symbols.size()));
+}
+
+void testConcurrentStorage() {
+    // threads interning overlapping sets of words into a concurrent storage agree on the ids, the strings that were
+    // there before keep theirs, and the strings can be read while others get added.
+    StringStorage<stringinfo, std::size_t> shared;
+    const std::size_t before = shared.getOrCreateString(std::string("before"));
+    shared.makeConcurrent();
+    const unsigned threads = 4;
+    const std::size_t per_thread = 5000;
+    std::vector<std::vector<std::size_t>> ids(threads);
+    parallelFor(threads, threads, [&](const std::size_t t) {
+        for (std::size_t i = 0; i < per_thread; ++i) {
+            const std::string word = std::to_string(i % 3000) + (i % 3 ? "" : "-" + std::to_string(t));
+            ids[t].push_back(shared.getOrCreateString(word));
+            const auto stored = shared.strings[ids[t].back()];
+            assertss(std::string(stored.begin(), stored.end()) == word, pt(word));
+        }
+    }, 1);
+    for (unsigned t = 0; t < threads; ++t) {
+        for (std::size_t i = 0; i < per_thread; ++i) {
+            if (i % 3) {
+                assertss(ids[t][i] == ids[0][i], pt(t) << pt(i));
+            }
+        }
+    }
+    std::set<std::string> distinct;
+    for (std::size_t i = 0; i < shared.strings.size(); ++i) {
+        distinct.emplace(shared.strings[i].begin(), shared.strings[i].end());
+    }
+    assertss(distinct.size() == shared.strings.size() && shared.getOrCreateString(std::string("before")) == before, pt(distinct.size()));
+}
+
+void testStringPool() {
+    // views from the pool stay valid while it grows over several slabs.
+    StringPool<char> pool;
+    const std::string small("a");
+    const auto first = pool[pool.append(small.begin(), small.end())];
+    const std::string large(5000, 'q');
+    for (int i = 0; i < 1000; ++i) {
+        assertss(pool.append(large.begin(), large.begin() + i % 50) == (std::size_t) i + 1, pt(i));
+    }
+    pool.append(large.begin(), large.end());
+    assertss(std::string(first.begin(), first.end()) == small && pool[1001].size() == large.size() && pool[50].size() == 49, pt(pool.size()));
+}
+
+void testInvariantsAfterAddIdentity() {
+    // ab == ba keeps the count of every symbol, a == b doesn't: once it got added equivalent() may no longer go by the
+    // counts of a and b.
+    struct symbolinfo {
+        typedef char symboltype;
+        typedef std::basic_string<symboltype> stringtype;
+    };
+    StringStorage<symbolinfo, std::size_t> ss;
+    KnuthBendixCompletion<symbolinfo, std::size_t> kbc(&ss);
+    kbc.addIdentity("ab", "ba");
+    kbc.run();
+    kbc.detectInvariants();
+    const std::size_t a = ss.getOrCreateString(std::string("a"));
+    const std::size_t b = ss.getOrCreateString(std::string("b"));
+    assertss(!kbc.equivalent(a, b), "");
+    kbc.addIdentity("a", "b");
+    kbc.run();
+    assertss(kbc.normalForm(a) == kbc.normalForm(b) && kbc.equivalent(a, b), "");
+}
+
+void testGenericSymbols() {
+    // symbols that are neither integral nor trivially copyable: hashed by symbolhash, looked up in the sorted alphabet
+    // of the invariants, and no checkpoints.
+    struct symbolinfo {
+        typedef std::string symboltype;
+        typedef std::vector<symboltype> stringtype;
+    };
+    StringStorage<symbolinfo, std::size_t> ordered_ss, hashed_ss;
+    hashed_ss.hashed_index = true;
+    KnuthBendixCompletion<symbolinfo, std::size_t> ordered(&ordered_ss);
+    KnuthBendixCompletion<symbolinfo, std::size_t> hashed(&hashed_ss);
+    for (auto *kbc : {&ordered, &hashed}) {
+        kbc->addIdentity({"to", "be"}, {"be", "to"});
+        kbc->addIdentity({"to", "to"}, {"to"});
+        assertss(kbc->run(), pt(kbc->current_rules.size()));
+        kbc->detectInvariants();
+        const std::size_t to = kbc->getOrCreateString(symbolinfo::stringtype{"to"});
+        const std::size_t be = kbc->getOrCreateString(symbolinfo::stringtype{"be"});
+        const std::size_t betoto = kbc->getOrCreateString(symbolinfo::stringtype{"be", "to", "to"});
+        assertss(!kbc->equivalent(to, be) && kbc->settled_by_invariants == 1 && kbc->equivalent(betoto, kbc->getOrCreateString(symbolinfo::stringtype{"to", "be"})), "");
+        assertss(!kbc->writeCheckpoint("test_knuth_bendix.checkpoint") && !kbc->loadCheckpoint("test_knuth_bendix.checkpoint"), "");
+    }
+    assertss(ordered.current_rules.size() == hashed.current_rules.size() && hashed_ss.strings.size() == ordered_ss.strings.size(), pt(hashed_ss.strings.size()) << pt(ordered_ss.strings.size()));
+}
+
 int main() {
     test1();
+    testSelfOverlap();
+    test2();
+    testParallelDeduction();
+    testHashedIndex();
+    testStats();
+    testCheckpoint();
+    testOrderings();
+    testLimits();
+    testOverlapIndex();
+    testNormalFormCache();
+    testLiveSystem();
+    testFixpoint();
+    testStringGarbage();
+    testAutomatonPruning();
+    testAutomatonSymbolOrder();
     test3();
+    testBatchQueries();
+    testCompiledSystem();
+    testSnapshot();
+    testInvariants();
+    testDominanceCatalog();
+    testMultiOrdering();
+    testPackedComparison();
+    testDenseAlphabet();
+    testConcurrentStorage();
+    testStringPool();
+    testInvariantsAfterAddIdentity();
+    testGenericSymbols();
 }